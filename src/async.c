@@ -0,0 +1,341 @@
+/*
+ *    bbe - Binary block editor
+ *
+ *    Copyright (C) 2005 Timo Savinen
+ *    This file is part of bbe.
+ *
+ *    bbe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    bbe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with bbe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "bbe.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREAD_H
+
+/**
+ * input read ahead by the reader thread straight to the input ring, see map_input_ring() in
+ * buffer.c. Bytes of stream offset n are at ring + n % ring_size.
+ */
+static unsigned char *ring;
+static size_t ring_size;
+static off_t ring_filled = 0;                 // bytes read by the reader thread
+static off_t ring_used = 0;                   // bytes given to read_input_stream
+static off_t ring_kept = 0;                   // stream offset of the input buffer, bytes after are kept
+static int ring_error = 0;                    // errno of the read error stopping the reader thread
+static int input_started = 0;
+
+static pthread_mutex_t input_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t input_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t input_free = PTHREAD_COND_INITIALIZER;
+
+/**
+ * output buffers written by the writer thread in order
+ */
+struct slot {
+  unsigned char *data;
+  size_t length;
+};
+
+static struct slot output_queue[OUTPUT_QUEUE];
+static unsigned long slots_queued = 0;        // buffers given to the writer thread
+static unsigned long slots_written = 0;       // buffers written
+static int output_started = 0;
+static int output_closing = 0;
+static int output_fd;
+static char *output_file;
+static pthread_t output_thread;
+
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t output_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t output_free = PTHREAD_COND_INITIALIZER;
+
+/**
+ * reader thread, reads the input files in order to the part of the ring after the input buffer
+ */
+static void *
+input_reader(void *arg) {
+  struct io_file *f;
+  size_t space;
+  ssize_t n;
+
+  for (f = (struct io_file *) arg; f != NULL; f = f->next) {
+    do {
+      pthread_mutex_lock(&input_lock);
+      while (ring_filled - ring_kept == (off_t) ring_size) pthread_cond_wait(&input_free, &input_lock);
+      space = (size_t) (ring_kept + (off_t) ring_size - ring_filled);
+      pthread_mutex_unlock(&input_lock);
+
+      do {                                    // the second mapping of the ring takes reads over its end
+        n = read(f->fd, ring + ring_filled % (off_t) ring_size, space);
+      } while (n == -1 && errno == EINTR);
+
+      pthread_mutex_lock(&input_lock);
+      if (n > 0) ring_filled += n;
+      if (n == 0) f->read_end = ring_filled;
+      if (n == -1) ring_error = errno;
+      pthread_cond_signal(&input_ready);
+      pthread_mutex_unlock(&input_lock);
+    } while (n > 0);
+    if (n == -1) break;
+  }
+  return NULL;
+}
+
+/**
+ * start reading the input files with a reader thread to the input ring of size bytes, used
+ * when input is not mapped
+ */
+void
+start_input_reader(struct io_file *files, unsigned char *input_ring, size_t size) {
+  pthread_t thread;
+
+  ring = input_ring;
+  ring_size = size;
+  if (pthread_create(&thread, NULL, input_reader, files)) return;
+  pthread_detach(thread);
+  input_started = 1;
+}
+
+/**
+ * read from current input file like read(). When the reader thread is started, the bytes are
+ * already in the ring at buffer and they are only counted.
+ * @return number of bytes read, 0 at end of file and -1 for error
+ */
+ssize_t
+read_input(struct io_file *file, unsigned char *buffer, size_t length) {
+  off_t end;
+  ssize_t n;
+
+  if (!input_started) return read(file->fd, buffer, length);
+
+  pthread_mutex_lock(&input_lock);
+  while (ring_used == ring_filled && file->read_end < 0 && !ring_error)
+    pthread_cond_wait(&input_ready, &input_lock);
+  end = file->read_end < 0 ? ring_filled : file->read_end;
+  if (ring_used < end) {
+    n = end - ring_used > (off_t) length ? (ssize_t) length : (ssize_t) (end - ring_used);
+    ring_used += n;
+  } else if (file->read_end < 0) {
+    errno = ring_error;
+    n = -1;
+  } else {
+    n = 0;
+  }
+  pthread_mutex_unlock(&input_lock);
+  return n;
+}
+
+/**
+ * tell the reader thread that the input buffer starts at stream offset offset, the ring
+ * before it can be read to
+ */
+void
+release_input(off_t offset) {
+  if (!input_started) return;
+
+  pthread_mutex_lock(&input_lock);
+  ring_kept = offset;
+  pthread_cond_signal(&input_free);
+  pthread_mutex_unlock(&input_lock);
+}
+
+/**
+ * writer thread, writes the queued buffers to output stream behind flush_buffer
+ */
+static void *
+output_writer(void *arg) {
+  struct slot *o;
+  size_t done;
+  ssize_t n;
+
+  (void) arg;
+  for (;;) {
+    pthread_mutex_lock(&output_lock);
+    while (slots_queued == slots_written && !output_closing) pthread_cond_wait(&output_ready, &output_lock);
+    if (slots_queued == slots_written) {
+      pthread_mutex_unlock(&output_lock);
+      break;
+    }
+    pthread_mutex_unlock(&output_lock);
+
+    o = &output_queue[slots_written % OUTPUT_QUEUE];
+    done = 0;
+    while (done < o->length) {
+      n = write(output_fd, o->data + done, o->length - done);
+      if (n == -1) {
+        if (errno == EINTR) continue;
+        panic("Error writing to", output_file, strerror(errno));
+      }
+      done += (size_t) n;
+    }
+
+    pthread_mutex_lock(&output_lock);
+    slots_written++;
+    pthread_cond_signal(&output_free);
+    pthread_mutex_unlock(&output_lock);
+  }
+  return NULL;
+}
+
+/**
+ * start writing the output stream with a writer thread
+ */
+void
+start_output_writer(int fd, char *file) {
+  int i;
+
+  for (i = 0; i < OUTPUT_QUEUE; i++) output_queue[i].data = xmalloc_buffer(output_buffer_size);
+  output_fd = fd;
+  output_file = file;
+  if (pthread_create(&output_thread, NULL, output_writer, NULL)) {
+    for (i = 0; i < OUTPUT_QUEUE; i++) free_buffer(output_queue[i].data, output_buffer_size);
+    return;
+  }
+  output_started = 1;
+}
+
+/**
+ * wait for a free output buffer
+ */
+static struct slot *
+free_slot() {
+  pthread_mutex_lock(&output_lock);
+  while (slots_queued - slots_written == OUTPUT_QUEUE) pthread_cond_wait(&output_free, &output_lock);
+  pthread_mutex_unlock(&output_lock);
+  return &output_queue[slots_queued % OUTPUT_QUEUE];
+}
+
+/**
+ * give the filled slot to the writer thread
+ */
+static void
+queue_slot() {
+  pthread_mutex_lock(&output_lock);
+  slots_queued++;
+  pthread_cond_signal(&output_ready);
+  pthread_mutex_unlock(&output_lock);
+}
+
+/**
+ * give bytes to the writer thread, buffer can be reused after return
+ * @return false if the writer thread is not started and caller must write the bytes
+ */
+int
+queue_output(unsigned char *buffer, size_t length) {
+  struct slot *o;
+
+  if (!output_started) return 0;
+
+  while (length > 0) {
+    o = free_slot();
+    o->length = length > output_buffer_size ? output_buffer_size : length;
+    memcpy(o->data, buffer, o->length);
+    buffer += o->length;
+    length -= o->length;
+    queue_slot();
+  }
+  return 1;
+}
+
+/**
+ * give a full output buffer of output_buffer_size bytes to the writer thread without copying it
+ * @return a free buffer in place of the given one, NULL if the writer thread is not started
+ */
+unsigned char *
+queue_output_buffer(unsigned char *buffer, size_t length) {
+  struct slot *o;
+  unsigned char *spare;
+
+  if (!output_started) return NULL;
+
+  o = free_slot();
+  spare = o->data;
+  o->data = buffer;
+  o->length = length;
+  queue_slot();
+  return spare;
+}
+
+/**
+ * wait until the writer thread has written all queued buffers, so the output stream
+ * can be written directly
+ */
+void
+drain_output() {
+  if (!output_started) return;
+
+  pthread_mutex_lock(&output_lock);
+  while (slots_queued != slots_written) pthread_cond_wait(&output_free, &output_lock);
+  pthread_mutex_unlock(&output_lock);
+}
+
+/**
+ * write the queued buffers and stop the writer thread
+ */
+void
+stop_output_writer() {
+  int i;
+
+  if (!output_started) return;
+
+  pthread_mutex_lock(&output_lock);
+  output_closing = 1;
+  pthread_cond_signal(&output_ready);
+  pthread_mutex_unlock(&output_lock);
+  pthread_join(output_thread, NULL);
+  output_started = 0;
+  for (i = 0; i < OUTPUT_QUEUE; i++) free_buffer(output_queue[i].data, output_buffer_size);
+}
+
+#else
+
+void
+start_input_reader(struct io_file *files, unsigned char *input_ring, size_t size) {
+}
+
+ssize_t
+read_input(struct io_file *file, unsigned char *buffer, size_t length) {
+  return read(file->fd, buffer, length);
+}
+
+void
+release_input(off_t offset) {
+}
+
+void
+start_output_writer(int fd, char *file) {
+}
+
+int
+queue_output(unsigned char *buffer, size_t length) {
+  return 0;
+}
+
+unsigned char *
+queue_output_buffer(unsigned char *buffer, size_t length) {
+  return NULL;
+}
+
+void
+drain_output() {
+}
+
+void
+stop_output_writer() {
+}
+
+#endif
@@ -1,267 +1,581 @@
-/*
- *    bbe - Binary block editor
- *
- *    Copyright (C) 2005 Timo Savinen
- *    This file is part of bbe.
- * 
- *    bbe is free software; you can redistribute it and/or modify
- *    it under the terms of the GNU General Public License as published by
- *    the Free Software Foundation; either version 2 of the License, or
- *    (at your option) any later version.
- *
- *    bbe is distributed in the hope that it will be useful,
- *    but WITHOUT ANY WARRANTY; without even the implied warranty of
- *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *    GNU General Public License for more details.
- *
- *    You should have received a copy of the GNU General Public License
- *    along with bbe; if not, write to the Free Software
- *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
- *
- */
-
-/* $Id: bbe.h,v 1.28 2005/11/11 13:06:53 timo Exp $ */
-
-//#ifdef HAVE_CONFIG_H
-#include "config.h"
-//#endif
-
-#ifdef HAVE_FEATURES_H
-#  include <features.h>
-#endif
-
-#ifdef HAVE_ERRNO_H
-#  include <errno.h>
-#endif
-
-#ifdef HAVE_ERROR_H
-#  include <error.h>
-#endif
-
-#ifdef HAVE_SYS_TYPES_H
-#  include <sys/types.h>
-#endif
-
-#ifdef HAVE_UNISTD_H
-#  include <unistd.h>
-#endif
-
-#ifdef HAVE_REGEX_H
-#  include <regex.h>
-#endif
-
-#include <stdio.h>
-
-#ifndef HAVE_OFF_T
-#  define off_t long int
-#endif
-
-/**
- * Types
- */
-
-/**
- * Constants
- */
-
-/**
- * exit values
- */
-#define EXIT_FAILURE 1
-#define EXIT_SUCCESS 0
-
-/**
- * Input buffer size
- */
-#define INPUT_BUFFER_LOW (16*1024)
-#define INPUT_BUFFER_SIZE (16*INPUT_BUFFER_LOW)
-#define INPUT_BUFFER_SAFE (INPUT_BUFFER_SIZE - INPUT_BUFFER_LOW)
-
-/**
- * Output buffer size
- */
-#define OUTPUT_BUFFER_LOW INPUT_BUFFER_LOW
-#define OUTPUT_BUFFER_SIZE (16*OUTPUT_BUFFER_LOW)
-#define OUTPUT_BUFFER_SAFE (OUTPUT_BUFFER_SIZE - OUTPUT_BUFFER_LOW)
-
-/**
- * block types
- */
-#define BLOCK_START_M 1
-#define BLOCK_START_S 2
-#define BLOCK_STOP_M  4
-#define BLOCK_STOP_S  8
-
-/**
- * structs
- */
-
-struct stringl {
-
-};
-
-struct pattern {
-  unsigned char *string;
-  off_t length;
-};
-
-/**
- * Block definition
- */
-struct block {
-  int type;
-  union {
-    off_t N;
-    struct pattern S;
-  } start;
-  union {
-    off_t M;
-    struct pattern S;
-  } stop;
-};
-
-/**
- * Commands
- */
-
-struct command_list {
-  char letter;            // command letter (D,A,s,..)
-  off_t offset;           // n for D,r,i and d commands
-  off_t count;            // count for d command
-  struct pattern s1;      // string for A,I,r,i,s,w and y commands
-  struct pattern s2;      // replace for s and dest for y
-  int rpos;               // replace position for s,r and y
-  off_t fpos;             // found pos for s-command
-  FILE *fd;               // stream for w command
-  struct command_list *next;
-};
-
-struct commands {
-  struct command_list *block_start;
-  struct command_list *byte;
-  struct command_list *block_end;
-};
-
-/**
- * in/out files
- */
-struct io_file {
-  char *file;
-  int fd;
-  off_t start_offset;
-  struct io_file *next;
-};
-
-/**
- * input buffer
- */
-struct input_buffer {
-  unsigned char *buffer;       // buffer to be malloced
-  unsigned char *read_pos;     // current read position
-  unsigned char *low_pos;      // low water mark
-  unsigned char *block_end;    // end of current block (if in buffer)
-  unsigned char *stream_end;   // end of stream (if in buffer)
-  off_t stream_offset;         // stream offset (at the beginning of buffer) current offset: offset + (read_pos - buffer)
-  off_t block_offset;          // block offset (start = 0) number of bytes read at position read_pos
-  off_t block_num;             // number of current block, first = 1
-};
-
-/**
- * output buffer
- */
-struct output_buffer {
-  unsigned char *buffer;
-  unsigned char *end;
-  unsigned char *write_pos;    // current write psotion;
-  unsigned char *low_pos;      // low water mark
-  off_t block_offset;          // block offset (start = 0) number of bytes written at position write_pos
-};
-
-
-/**
- * function prototypes
- */
-extern void
-panic(char *msg, char *info1, char *syserror);
-
-extern void
-panic_c(char *msg, char action, char *info1, char *syserror);
-
-extern void *
-xmalloc(size_t size);
-
-extern void
-set_output_file(char *file);
-
-extern void
-set_input_file(char *file);
-
-extern void
-init_buffer();
-
-extern unsigned char
-read_byte();
-
-extern int
-get_next_byte();
-
-extern void
-mark_block_end();
-
-extern int
-find_block();
-
-extern int
-last_byte();
-
-extern void
-write_buffer(unsigned char *buf, off_t length);
-
-extern void
-put_byte(unsigned char byte);
-
-extern void
-write_next_byte();
-
-extern void
-flush_buffer();
-
-extern void
-init_commands(struct commands *c);
-
-extern void
-close_commands(struct commands *c);
-
-extern void
-close_output_stream();
-
-extern void
-write_w_command(unsigned char *buf, size_t length);
-
-extern void
-execute_program(struct commands *c);
-
-extern void
-write_string(char *string);
-
-extern char *
-get_current_file(void);
-
-extern unsigned char *
-read_pos();
-
-extern unsigned char *
-block_end_pos();
-
-extern char *
-xstrdup(char *str);
-
-/**
- * global variables
- */
-extern struct block block;
-extern struct command *commands;
-extern struct io_file out_stream;
-extern struct input_buffer in_buffer;
-extern struct output_buffer out_buffer;
-extern int output_only_block;
+/*
+ *    bbe - Binary block editor
+ *
+ *    Copyright (C) 2005 Timo Savinen
+ *    This file is part of bbe.
+ * 
+ *    bbe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    bbe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with bbe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* $Id: bbe.h,v 1.28 2005/11/11 13:06:53 timo Exp $ */
+
+//#ifdef HAVE_CONFIG_H
+#include "config.h"
+//#endif
+
+#ifdef HAVE_FEATURES_H
+#  include <features.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#  include <errno.h>
+#endif
+
+#ifdef HAVE_ERROR_H
+#  include <error.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#  include <sys/types.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#  if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#    define MAP_ANONYMOUS MAP_ANON
+#  endif
+#endif
+
+#ifdef HAVE_SYS_UIO_H
+#  include <sys/uio.h>
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#  define THREAD_LOCAL __thread
+#else
+#  define THREAD_LOCAL
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define HAVE_X86_SIMD
+#  include <immintrin.h>
+#endif
+
+#include <stdio.h>
+
+#ifndef HAVE_OFF_T
+#  define off_t long int
+#endif
+
+/**
+ * Types
+ */
+
+/**
+ * Constants
+ */
+
+/**
+ * exit values
+ */
+#define EXIT_FAILURE 1
+#define EXIT_SUCCESS 0
+
+/**
+ * Default input buffer size (-I). The low water mark is 1/BUFFER_LOW_PART of the buffer, or
+ * the longest string searched ahead of the read position, whichever is longer.
+ */
+#define INPUT_BUFFER_SIZE (256*1024)
+#define BUFFER_LOW_PART 16
+
+/**
+ * Size of the window mapped from a regular input file
+ */
+#define INPUT_MAP_WINDOW (sizeof(void *) > 4 ? ((size_t) 1 << 30) : ((size_t) 1 << 26))
+
+/**
+ * Gaps between blocks at least this long are copied from a mapped input file to the output
+ * by the kernel
+ */
+#define INPUT_GAP_COPY (64*1024)
+
+/**
+ * With -i, changed ranges closer than this are written back with one pwrite
+ */
+#define IN_PLACE_GAP 16
+
+/**
+ * Default output buffer size (-O), spans of input at least OUTPUT_BUFFER_LOW bytes
+ * long are written without copying them to the output buffer
+ */
+#define OUTPUT_BUFFER_SIZE (256*1024)
+#define OUTPUT_BUFFER_LOW (16*1024)
+
+/**
+ * Smallest buffer size for -I and -O, buffers at least HUGE_BUFFER bytes long are
+ * backed by huge pages if possible
+ */
+#define BUFFER_MIN (4*1024)
+#define HUGE_BUFFER (2*1024*1024)
+
+/**
+ * Size of the input ring in input buffers, the input after the buffer is read ahead by the
+ * reader thread, and the output buffers written behind by the writer thread
+ */
+#define INPUT_QUEUE 4
+#define OUTPUT_QUEUE 4
+
+/**
+ * Size of the input part given to a worker thread (-j), and the number of parts per
+ * worker which can be processed ahead of the output
+ */
+#define PARALLEL_PART_SIZE (4*1024*1024)
+#define PARALLEL_QUEUE 4
+
+/**
+ * Largest transition table of the automaton for the search strings of s commands, bigger
+ * groups are searched command by command, a single bigger string with its failure function
+ */
+#define AUTOMATON_MAX (16*1024*1024)
+
+/**
+ * Longest match of the regular expression of a t command, the input buffer keeps this many
+ * bytes ahead of the read position
+ */
+#define REGEX_MATCH_MAX (16*1024)
+
+/**
+ * block types
+ */
+#define BLOCK_START_M 1
+#define BLOCK_START_S 2
+#define BLOCK_STOP_M  4
+#define BLOCK_STOP_S  8
+#define BLOCK_START_R 16
+#define BLOCK_STOP_R  32
+
+/**
+ * structs
+ */
+
+struct stringl {
+
+};
+
+/**
+ * byte string, a search string can have a mask: byte b matches string[i] if
+ * (b & mask[i]) == string[i]. mask is NULL when all bits must match.
+ */
+struct pattern {
+  unsigned char *string;
+  off_t length;
+  unsigned char *mask;
+};
+
+/**
+ * search tables for a pattern, see search.c
+ */
+struct search {
+  struct pattern *pattern;
+  size_t skip[256];       // shift by the last byte of the window
+  size_t split;           // critical factorization of the pattern
+  size_t period;          // shift after a match of the right half
+  size_t memory;          // bytes already known to match after period shift
+  size_t filter[2];       // positions of a masked pattern compared before the whole pattern
+  unsigned char *(*find)(struct search *s, unsigned char *scan, unsigned char *last);
+};
+
+/**
+ * automaton finding several strings in one pass over the input, see search.c
+ */
+struct automaton {
+  int classes;            // number of byte classes, a power of two, bytes not in any string
+  int shift;              // share class 0 unless every byte is in one. classes is 1 << shift
+  unsigned char class[256];
+  int *next;              // next state times classes for each state and class, negated
+                          // with ~ when strings end in the next state, NULL for one string
+  unsigned char *string;  // the string and its failure function when next is NULL
+  int *fail;
+  int *output_start;      // indexes of the strings ending in state s are
+  int *output_end;        // matches[output_start[s]] .. matches[output_end[s] - 1]
+  int *matches;
+  off_t longest;          // length of the longest string
+};
+
+/**
+ * anchors of a regular expression match
+ */
+#define REGEX_BOL 1       // match starts at the start of the block
+#define REGEX_EOL 2       // match ends at the end of the block
+
+/**
+ * regular expression of a t command compiled to a DFA, see regex.c
+ */
+struct regex {
+  int classes;            // number of byte classes, bytes of a class are in the same sets
+  unsigned char class[256];
+  int states;
+  int *next;              // next state for each state and class, state 0 never matches
+  unsigned char *accept;  // states after a match, 1 = match, 2 = match at the end of the block ($)
+  int start;              // start state
+  int bol;                // start state at the start of the block (^)
+  unsigned char ending[256];   // bytes a match can end with
+  int groups;             // number of ( ) groups
+  struct rx_inst *program;     // program finding the groups of a match
+  int program_length;
+  unsigned char (*set)[32];    // byte sets of the program
+  int sets;
+  unsigned char *replace; // replacement of t command
+  int *reference;         // group replacing each byte of replace, -1 for the byte itself
+  off_t replace_length;
+  int references;         // replacement has group references
+  off_t expansion_max;    // longest replacement with the groups
+  struct regex *reverse;  // block delimiter reversed, finds the start of a match
+};
+
+/**
+ * search of a regular expression block delimiter, see buffer.c
+ */
+struct delimiter {
+  struct regex *regex;
+  off_t key;              // search continues while the caller gives the same key
+  off_t lower;            // matches start at or after this stream offset
+  off_t scan;             // next stream offset given to the DFA
+  int state;              // state of the DFA at scan
+};
+
+/**
+ * Block definition
+ */
+struct block {
+  int type;
+  union {
+    off_t N;
+    struct pattern S;
+    struct regex *R;
+  } start;
+  union {
+    off_t M;
+    struct pattern S;
+    struct regex *R;
+  } stop;
+};
+
+/**
+ * Commands
+ */
+
+struct command_list {
+  char letter;            // command letter (D,A,s,..)
+  off_t offset;           // n for D,r,i and d commands
+  off_t count;            // count for d command
+  struct pattern s1;      // string for A,I,r,i,s,w and y commands
+  struct pattern s2;      // replace for s and dest for y
+  struct regex *regex;    // search and replace for t
+  int rpos;               // replace position for s,r and y
+  off_t fpos;             // found pos for s-command
+  FILE *fd;               // stream for w command
+  struct command_list *next;
+};
+
+/**
+ * Byte command compiled for execution, see compile_commands()
+ */
+struct op {
+  void *label;            // address of the handler
+  int code;               // OP_* code of the handler
+  off_t offset;           // n for d,i,r,u and f commands
+  off_t count;            // count for d,j and l commands
+  unsigned char *string;  // s1 of the command
+  off_t length;
+  unsigned char *mask;    // mask of s1 for s command, see struct pattern
+  unsigned char *string2; // s2 of the command
+  off_t length2;
+  unsigned char byte;     // operand for &,|,^,u and f commands
+  unsigned char *table;   // translation of fused y,&,|,^,~ and x commands, first bytes of a group
+  off_t rpos;             // replace position, reset for each block
+  off_t fpos;             // found position for s command
+  struct automaton *automaton;  // search strings of a group of s commands
+  struct regex *regex;    // t command, replacement of a match is put to string2
+  unsigned long *first;   // group members with a one byte search string, for each byte value
+  unsigned long *members; // group members which can start at each input offset, and those replacing
+  off_t scan;             // next input offset given to the automaton, or searched by t command
+  int state;              // state of the automaton at scan, see struct automaton
+  off_t ending;           // last input offset before scan a match of t command can end at
+};
+
+struct commands {
+  struct command_list *block_start;
+  struct command_list *byte;
+  struct command_list *block_end;
+};
+
+/**
+ * in/out files
+ */
+struct io_file {
+  char *file;
+  int fd;
+  off_t start_offset;
+  off_t read_end;         // stream offset after the file, set by the reader thread, -1 before
+  struct io_file *next;
+};
+
+/**
+ * input buffer
+ */
+struct input_buffer {
+  unsigned char *buffer;       // buffer to be malloced or mapped
+  unsigned char *end;          // end of buffer
+  unsigned char *read_pos;     // current read position
+  unsigned char *low_pos;      // low water mark
+  unsigned char *block_end;    // end of current block (if in buffer)
+  unsigned char *stream_end;   // end of stream (if in buffer)
+  off_t stream_offset;         // stream offset (at the beginning of buffer) current offset: offset + (read_pos - buffer)
+  off_t block_offset;          // block offset (start = 0) number of bytes read at position read_pos
+  off_t block_num;             // number of current block, first = 1
+};
+
+/**
+ * output buffer
+ */
+struct output_buffer {
+  unsigned char *buffer;
+  unsigned char *end;
+  unsigned char *write_pos;    // current write psotion;
+  unsigned char *low_pos;      // low water mark
+  off_t block_offset;          // block offset (start = 0) number of bytes written at position write_pos
+};
+
+/**
+ * offsets of block start or stop strings found in a part of the input, relative to the part
+ */
+struct occurrences {
+  unsigned int *offset;
+  size_t count;
+  size_t size;
+};
+
+/**
+ * memory buffer collecting the output of a worker thread
+ */
+struct sink {
+  unsigned char *buffer;
+  size_t length;
+  size_t size;
+};
+
+
+/**
+ * function prototypes
+ */
+extern void
+panic(char *msg, char *info1, char *syserror);
+
+extern void
+panic_c(char *msg, char action, char *info1, char *syserror);
+
+extern void *
+xmalloc(size_t size);
+
+extern void *
+xmalloc_buffer(size_t size);
+
+extern void
+free_buffer(void *buffer, size_t size);
+
+extern void
+set_output_file(char *file);
+
+extern void
+set_input_file(char *file);
+
+extern void
+init_buffer(off_t longest);
+
+extern void
+init_output_buffer();
+
+extern void
+set_output_sink(struct sink *sink);
+
+extern off_t
+mapped_input_size();
+
+extern void
+map_input_part(off_t offset, off_t length, off_t block_num);
+
+extern void
+unmap_input_part();
+
+extern void
+scan_input_part(off_t offset, off_t length, struct occurrences *starts, struct occurrences *stops);
+
+extern unsigned char
+read_byte();
+
+extern int
+get_next_byte();
+
+extern void
+mark_block_end();
+
+extern int
+find_block();
+
+extern int
+last_byte();
+
+extern unsigned char *
+span_end();
+
+extern int
+next_span(unsigned char *last);
+
+extern void
+write_buffer(unsigned char *buf, off_t length);
+
+extern void
+write_input_span(unsigned char *buf, off_t length);
+
+extern void
+put_byte(unsigned char byte);
+
+extern void
+write_next_byte();
+
+extern void
+flush_buffer();
+
+extern void
+init_commands(struct commands *c);
+
+extern void
+compile_commands(struct commands *c);
+
+extern void
+close_commands(struct commands *c);
+
+extern void
+write_output_stream(unsigned char *buffer, ssize_t length);
+
+extern void
+close_output_stream();
+
+extern void
+close_input_stream();
+
+extern void
+set_in_place_output(char *journal);
+
+extern int
+in_place_output();
+
+extern int
+length_preserving(struct commands *c);
+
+extern off_t
+longest_search(struct commands *c);
+
+extern void
+write_w_command(unsigned char *buf, size_t length);
+
+extern void
+execute_program(struct commands *c);
+
+extern void
+execute_blocks(struct commands *c);
+
+extern void
+init_worker_program();
+
+extern int
+execute_parallel(struct commands *c);
+
+extern void
+start_input_reader(struct io_file *files, unsigned char *input_ring, size_t size);
+
+extern void
+release_input(off_t offset);
+
+extern ssize_t
+read_input(struct io_file *file, unsigned char *buffer, size_t length);
+
+extern void
+start_output_writer(int fd, char *file);
+
+extern int
+queue_output(unsigned char *buffer, size_t length);
+
+extern unsigned char *
+queue_output_buffer(unsigned char *buffer, size_t length);
+
+extern void
+drain_output();
+
+extern void
+stop_output_writer();
+
+extern void
+write_string(char *string);
+
+extern char *
+get_current_file(void);
+
+extern unsigned char *
+read_pos();
+
+extern unsigned char *
+block_end_pos();
+
+extern char *
+xstrdup(char *str);
+
+extern void *
+xrealloc(void *ptr, size_t size);
+
+extern void
+init_search(struct search *s, struct pattern *pattern);
+
+extern unsigned char *
+find_pattern(struct search *s, unsigned char *scan, unsigned char *last);
+
+extern int
+init_automaton(struct automaton *a, struct pattern *strings, int count);
+
+extern int
+parse_escape(char **pos, char *string);
+
+extern struct regex *
+compile_regex(char *expression);
+
+extern struct regex *
+compile_delimiter(char *expression);
+
+extern void
+parse_replacement(struct regex *r, char *replace);
+
+extern off_t
+expand_replacement(struct regex *r, unsigned char first, unsigned char *rest, off_t length, int anchors, unsigned char *target);
+
+/**
+ * global variables
+ */
+extern struct block block;
+extern struct command *commands;
+extern struct io_file out_stream;
+extern THREAD_LOCAL struct input_buffer in_buffer;
+extern THREAD_LOCAL struct output_buffer out_buffer;
+extern int output_only_block;
+extern int jobs;
+extern off_t last_live_block;
+extern size_t input_buffer_size;
+extern size_t output_buffer_size;
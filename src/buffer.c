@@ -1,525 +1,1508 @@
-/*
- *    bbe - Binary block editor
- *
- *    Copyright (C) 2005 Timo Savinen
- *    This file is part of bbe.
- * 
- *    bbe is free software; you can redistribute it and/or modify
- *    it under the terms of the GNU General Public License as published by
- *    the Free Software Foundation; either version 2 of the License, or
- *    (at your option) any later version.
- *
- *    bbe is distributed in the hope that it will be useful,
- *    but WITHOUT ANY WARRANTY; without even the implied warranty of
- *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *    GNU General Public License for more details.
- *
- *    You should have received a copy of the GNU General Public License
- *    along with bbe; if not, write to the Free Software
- *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
- *
- */
-
-/* $Id: buffer.c,v 1.37 2006-11-02 17:11:36 timo Exp $ */
-
-#include "bbe.h"
-#include <stdlib.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <string.h>
-
-#ifdef WIN32
-
-#include <share.h>
-
-#endif
-
-/**
- * output file 
- */
-struct io_file out_stream;
-
-/**
- * list of input files, points to current file 
- */
-struct io_file *in_stream = NULL;
-struct io_file *in_stream_start = NULL;
-
-/**
- * input buffer
- */
-struct input_buffer in_buffer;
-
-/**
- * output buffer
- */
-struct output_buffer out_buffer;
-
-/**
- * open the output file
- */
-void
-set_output_file(char *file) {
-  if (out_stream.file != NULL) panic("Only one output file can be defined", NULL, NULL);
-
-  if (file == NULL) {
-    out_stream.fd = STDOUT_FILENO;
-    out_stream.file = "(stdout)";
-  } else {
-#ifdef WIN32
-    errno_t rc = _sopen_s(&out_stream.fd, file,
-                          _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
-                          _SH_DENYNO, _S_IREAD | _S_IWRITE);
-    if (rc != 0) panic("Cannot open for writing", file, strerror(rc));
-#else
-    out_stream.fd = open(file,
-                         O_WRONLY | O_CREAT | O_TRUNC,
-                         S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
-
-    if(out_stream.fd == -1) panic("Cannot open for writing",file,strerror(errno));
-#endif
-    out_stream.file = xstrdup(file);
-  }
-}
-
-/**
- * write to output stream from arbitrary buffer
- */
-void
-write_output_stream(unsigned char *buffer, ssize_t length) {
-  if (write(out_stream.fd, buffer, length) == -1)
-    panic("Error writing to", out_stream.file, strerror(errno));
-}
-
-
-/**
- * open an input file and put it in input file list
- */
-void
-set_input_file(char *file) {
-  struct io_file *new, *curr;
-
-  new = xmalloc(sizeof(struct io_file));
-  new->next = NULL;
-
-  if (in_stream == NULL) {
-    in_stream = new;
-    in_stream_start = in_stream;
-  } else {
-    curr = in_stream;
-    while (curr->next != NULL) {
-      curr = curr->next;
-    }
-    curr->next = new;
-  }
-
-  new->start_offset = (off_t) 0;
-  if (file[0] == '-' && file[1] == 0) {
-    new->fd = STDIN_FILENO;
-    new->file = "(stdin)";
-  } else {
-#ifdef WIN32
-    errno_t rc = _sopen_s(&new->fd, file,
-                          _O_RDONLY | _O_BINARY,
-                          _SH_DENYWR, _S_IREAD);
-    if (rc != 0) panic("Cannot open for reading", file, strerror(rc));
-#else
-    new->fd = open(file,O_RDONLY);
-    if(new->fd == -1) panic("Cannot open file for reading",file,strerror(errno));
-#endif
-    new->file = xstrdup(file);
-  }
-}
-
-/**
- * return the name of current input file
- */
-char *
-get_current_file(void) {
-  struct io_file *f = in_stream_start;
-  struct io_file *prev;
-  off_t current_offset = in_buffer.stream_offset + (off_t) (in_buffer.read_pos - in_buffer.buffer);
-
-  if (f == NULL) return "";
-
-  while (f != NULL) {
-    prev = f;
-    f = f->next;
-    if (f != NULL && (f->start_offset == (off_t) 0 || f->start_offset > current_offset)) {
-      f = NULL;
-    }
-  }
-  return prev->file;
-}
-
-
-/**
- * initialize in and out buffers
- */
-void
-init_buffer() {
-  in_buffer.buffer = xmalloc(INPUT_BUFFER_SIZE);
-  in_buffer.read_pos = NULL;
-  in_buffer.stream_end = NULL;
-  in_buffer.low_pos = in_buffer.buffer + INPUT_BUFFER_SAFE;
-  in_buffer.block_num = 0;
-
-  out_buffer.buffer = xmalloc(OUTPUT_BUFFER_SIZE);
-  out_buffer.end = out_buffer.buffer + OUTPUT_BUFFER_SIZE;
-  out_buffer.write_pos = out_buffer.buffer;
-  out_buffer.low_pos = out_buffer.buffer + OUTPUT_BUFFER_SAFE;
-}
-
-/**
- * get a new set of bytes for the buffer
- * @return the number of bytes read.
- */
-ssize_t
-read_input_stream() {
-  ssize_t read_count, last_read, to_be_read, to_be_saved;
-  unsigned char *buffer_write_pos;
-
-  if (in_buffer.stream_end != NULL) return (ssize_t) 0;  // can't read more
-
-  if (in_buffer.read_pos == NULL)        // first read, so just fill buffer
-  {
-    to_be_read = INPUT_BUFFER_SIZE;
-    to_be_saved = 0;
-    buffer_write_pos = in_buffer.buffer;
-    in_buffer.stream_offset = (off_t) 0;
-  } else                                            //we have already read something
-  {
-    to_be_read = in_buffer.read_pos - in_buffer.buffer;
-    to_be_saved = (ssize_t) INPUT_BUFFER_SIZE - to_be_read;
-    if (to_be_saved > INPUT_BUFFER_SIZE / 2)
-      panic("buffer error: reading to half full buffer", NULL, NULL);
-    memcpy(in_buffer.buffer, in_buffer.read_pos, to_be_saved);    // move "low water" part to beginning of buffer
-    buffer_write_pos = in_buffer.buffer + to_be_saved;
-    in_buffer.stream_offset += (off_t) to_be_read;
-    if (in_buffer.block_end != NULL) in_buffer.block_end -= to_be_read;
-  }
-
-  in_buffer.read_pos = in_buffer.buffer;
-
-  read_count = 0;
-  do {
-    last_read = read(in_stream->fd, buffer_write_pos + read_count, (size_t) (to_be_read - read_count));
-    if (last_read == -1) panic("Error reading file", in_stream->file, strerror(errno));
-    if (last_read == 0) {
-      if (close(in_stream->fd) == -1)
-        panic("Error in closing file", in_stream->file, strerror(errno));
-      in_stream = in_stream->next;
-      if (in_stream != NULL)
-        in_stream->start_offset = in_buffer.stream_offset + (off_t) read_count + (off_t) to_be_saved;
-    }
-    read_count += last_read;
-  } while (in_stream != NULL && read_count < to_be_read);
-
-  if (read_count < to_be_read) in_buffer.stream_end = buffer_write_pos + read_count - 1;
-
-  return read_count;
-}
-
-/**
- * @return byte from the buffer
- */
-unsigned char
-read_byte() {
-  return *in_buffer.read_pos;
-}
-
-/**
- * @return pointer to the read position
- */
-unsigned char *
-read_pos() {
-  return in_buffer.read_pos;
-}
-
-/**
- * @return the block end pointer
- */
-unsigned char *
-block_end_pos() {
-  return in_buffer.block_end;
-}
-
-/**
- * advances the read pointer, if buffer has reached low water, get more from stream to buffer.
- * @return false in case of end of stream
- */
-
-int
-get_next_byte() {
-  if (in_buffer.read_pos >= in_buffer.low_pos) {
-    read_input_stream();
-    if (in_buffer.block_end == NULL) mark_block_end();
-  }
-
-  if (in_buffer.stream_end != NULL) {
-    if (in_buffer.read_pos >= in_buffer.stream_end) {
-      return 0;
-    }
-  }
-
-  in_buffer.read_pos++;
-  in_buffer.block_offset++;
-  return 1;
-}
-
-/**
- * check if the eof current block is in buffer and mark it in_buffer.block_end
- */
-void
-mark_block_end() {
-  unsigned char *safe_search, *scan;
-  int i;
-
-  if (in_buffer.stream_end != NULL) {
-    safe_search = in_buffer.stream_end;
-  } else {
-    safe_search = in_buffer.buffer + INPUT_BUFFER_SIZE;
-  }
-
-  in_buffer.block_end = NULL;
-
-  if (block.type & BLOCK_STOP_M) {
-    in_buffer.block_end = in_buffer.read_pos + (block.stop.M - in_buffer.block_offset - 1);
-    if (in_buffer.block_end > safe_search) in_buffer.block_end = NULL;
-  }
-
-
-  if (block.type & BLOCK_STOP_S) {
-    scan = in_buffer.read_pos;
-    if (block.stop.S.length) {
-      if (block.type & BLOCK_START_S && in_buffer.block_offset < block.start.S.length)
-        scan += block.start.S.length - in_buffer.block_offset;
-      i = 0;
-      while (scan <= safe_search - block.stop.S.length + 1 && i < block.stop.S.length) {
-        i = 0;
-        while (*scan == block.stop.S.string[i] && i < block.stop.S.length) {
-          scan++;
-          i++;
-        }
-        if (i) {
-          scan -= i - 1;
-        } else {
-          scan++;
-        }
-      }
-
-      if (i == block.stop.S.length) {
-        scan += i - 2;
-        in_buffer.block_end = scan;
-      }
-    } else {
-      if (block.type & BLOCK_START_S) {
-        if (block.start.S.length) {
-          if (in_buffer.block_offset < block.start.S.length)          // to skip block start
-            scan += block.start.S.length - in_buffer.block_offset;
-
-          i = 0;
-
-          while (scan <= safe_search - block.start.S.length + 1 && i < block.start.S.length) {
-            i = 0;
-            while (*scan == block.start.S.string[i] && i < block.start.S.length) {
-              scan++;
-              i++;
-            }
-            if (i) {
-              scan -= i - 1;
-            } else {
-              scan++;
-            }
-          }
-
-          if (i == block.start.S.length) {
-            in_buffer.block_end = scan - 2;
-          }
-        } else {
-          panic("Both block start and stop zero size", NULL, NULL);
-        }
-      }
-    }
-  }
-
-  if (in_buffer.block_end == NULL && in_buffer.stream_end != NULL)
-    in_buffer.block_end = in_buffer.stream_end;
-}
-
-/**
- * @return true if current byte is last in block
- */
-int
-last_byte() {
-  return in_buffer.block_end == in_buffer.read_pos;
-}
-
-/**
- * @return true (1) if end of stream has been reached
- */
-static inline int
-end_of_stream() {
-  if (in_buffer.stream_end == NULL) return 0;
-  if (in_buffer.stream_end > in_buffer.read_pos) return 0;
-  return 1;
-}
-
-/**
- * read for stream to input buffer and advance the read_pos to the start of the buffer
- * in_buffer.read_pos should point to last byte of previous block
- */
-int
-find_block() {
-  unsigned char *safe_search, *scan_start;
-  register int i;
-  int found;
-
-  found = 0;
-
-  if (end_of_stream() && last_byte()) return 0;
-
-  if (in_buffer.read_pos == NULL)  // first read
-  {
-    if (!read_input_stream()) return 0;  // zero size input
-  }
-
-  in_buffer.block_offset = 0;
-
-  do {
-    if (in_buffer.read_pos >= in_buffer.low_pos) read_input_stream();
-
-    if (last_byte()) in_buffer.read_pos++;
-    in_buffer.block_end = NULL;
-
-    scan_start = in_buffer.read_pos;
-
-    if (in_buffer.stream_end != NULL) {
-      safe_search = in_buffer.stream_end;
-    } else {
-      safe_search = in_buffer.low_pos;
-    }
-
-    if (in_buffer.read_pos <= safe_search) {
-      if (block.type & BLOCK_START_M) {
-        if (block.start.N >= in_buffer.stream_offset + (off_t) (in_buffer.read_pos - in_buffer.buffer) &&
-            block.start.N <= in_buffer.stream_offset + (off_t) (safe_search - in_buffer.buffer)) {
-          in_buffer.read_pos = in_buffer.buffer + (block.start.N - in_buffer.stream_offset);
-          found = 1;
-        } else {
-          in_buffer.read_pos = safe_search;
-        }
-      }
-
-      if (block.type & BLOCK_START_S) {
-        if (block.start.S.length > 0) {
-          i = 0;
-          if (in_buffer.stream_end == NULL) safe_search += block.start.S.length - 1;
-          while (in_buffer.read_pos <= safe_search - block.start.S.length + 1 && i < block.start.S.length) {
-            i = 0;
-            while (*in_buffer.read_pos == block.start.S.string[i] && i < block.start.S.length) {
-              in_buffer.read_pos++;
-              i++;
-            }
-            if (i) {
-              in_buffer.read_pos -= i - 1;
-            } else {
-              in_buffer.read_pos++;
-            }
-          }
-
-          if (i == block.start.S.length) {
-            in_buffer.read_pos--;
-            found = 1;
-          } else if (scan_start == in_buffer.read_pos) {
-            in_buffer.read_pos++;
-          }
-
-          if (in_buffer.read_pos > in_buffer.stream_end && in_buffer.stream_end != NULL) in_buffer.read_pos--;
-
-        } else {
-          found = 1;
-        }
-      }
-      if (in_buffer.read_pos > scan_start && !output_only_block)
-        write_output_stream(scan_start, in_buffer.read_pos - scan_start);
-      if (found) mark_block_end();
-    }
-  } while (!found && !end_of_stream());
-  if (end_of_stream() && !found && !output_only_block) write_output_stream(in_buffer.read_pos, 1);
-  if (found) in_buffer.block_num++;
-  return found;
-}
-
-/**
- * write null terminated string
- */
-void
-write_string(char *string) {
-  register char *f;
-
-  f = string;
-
-  while (*f != 0) f++;
-
-  write_buffer(string, (off_t) (f - string));
-}
-
-/**
- * write_buffer at the current write position
- */
-void
-write_buffer(unsigned char *buf, off_t length) {
-
-  if (!length) return;
-
-  if (out_buffer.write_pos + length >= out_buffer.end) {
-    if (out_buffer.write_pos == out_buffer.buffer) panic("Out buffer too small, should not happen!", NULL, NULL);
-    flush_buffer();
-  }
-  memcpy(out_buffer.write_pos, buf, length);
-  out_buffer.write_pos += length;
-  out_buffer.block_offset += length;
-}
-
-/**
- * put_byte, put one byte att current write position
- */
-void
-put_byte(unsigned char byte) {
-  *out_buffer.write_pos = byte;
-}
-
-/**
- * next_byte, advance the write pointer by one
- */
-/**
- * if buffer full write it to disk
- */
-void
-write_next_byte() {
-  out_buffer.write_pos++;
-  out_buffer.block_offset++;
-  if (out_buffer.write_pos >= out_buffer.end) {
-    flush_buffer();
-  }
-}
-
-/**
- * write unwritten data from buffer to disk
- */
-void
-flush_buffer() {
-  write_output_stream(out_buffer.buffer, out_buffer.write_pos - out_buffer.buffer);
-  write_w_command(out_buffer.buffer, out_buffer.write_pos - out_buffer.buffer);
-  out_buffer.write_pos = out_buffer.buffer;
-}
-
-/**
- * close_output_stream
- */
-void
-close_output_stream() {
-  if (close(out_stream.fd) == -1) panic("Error closing output stream", out_stream.file, strerror(errno));
-}
-
+/*
+ *    bbe - Binary block editor
+ *
+ *    Copyright (C) 2005 Timo Savinen
+ *    This file is part of bbe.
+ * 
+ *    bbe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    bbe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with bbe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* $Id: buffer.c,v 1.37 2006-11-02 17:11:36 timo Exp $ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE     // copy_file_range and splice
+#endif
+
+#include "bbe.h"
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+
+#ifdef WIN32
+
+#include <share.h>
+
+#endif
+
+/**
+ * output file 
+ */
+struct io_file out_stream;
+
+/**
+ * list of input files, points to current file 
+ */
+struct io_file *in_stream = NULL;
+struct io_file *in_stream_start = NULL;
+
+/**
+ * input buffer
+ */
+THREAD_LOCAL struct input_buffer in_buffer;
+
+/**
+ * output buffer
+ */
+THREAD_LOCAL struct output_buffer out_buffer;
+
+/**
+ * output of a worker thread is collected here instead of writing it to the output stream
+ */
+static THREAD_LOCAL struct sink *output_sink = NULL;
+
+/**
+ * -i state, file offset of the next output byte, journal and buffer for the original bytes
+ */
+static int in_place = 0;
+static off_t output_offset = 0;
+static int journal_fd = -1;
+static char *journal_name = NULL;
+static unsigned char *in_place_original = NULL;
+
+/**
+ * input buffer low water mark, set in init_buffer
+ */
+static size_t input_buffer_low;
+
+/**
+ * read input is seeked to the numeric block start instead of reading it ahead
+ */
+static int seek_input = 0;
+
+/**
+ * search tables for block start and stop strings
+ */
+static struct search start_search;
+static struct search stop_search;
+
+/**
+ * searches of regular expression block delimiters, stop_delimiter finds also the start
+ * of the next block when blocks have no stop
+ */
+static struct delimiter start_delimiter;
+static struct delimiter stop_delimiter;
+
+/**
+ * length of the start string or match of the current block
+ */
+static THREAD_LOCAL off_t block_start_length = 0;
+
+/**
+ * block start at a fixed stream offset
+ * @return true if the start is between the read position and safe_search
+ */
+static int
+find_start_number(unsigned char *safe_search) {
+  if (block.start.N >= in_buffer.stream_offset + (off_t) (in_buffer.read_pos - in_buffer.buffer) &&
+      block.start.N <= in_buffer.stream_offset + (off_t) (safe_search - in_buffer.buffer)) {
+    in_buffer.read_pos = in_buffer.buffer + (block.start.N - in_buffer.stream_offset);
+    block_start_length = 0;
+    return 1;
+  }
+  in_buffer.read_pos = safe_search;
+  return 0;
+}
+
+/**
+ * block start at the start string
+ * @return true if the start string is found
+ */
+static int
+find_start_string(unsigned char *safe_search) {
+  unsigned char *match;
+  int found = 0;
+
+  if (in_buffer.stream_end == NULL) safe_search += block.start.S.length - 1;
+  safe_search -= block.start.S.length - 1;      // last possible start of the string
+  match = find_pattern(&start_search, in_buffer.read_pos, safe_search);
+
+  if (match != NULL) {
+    in_buffer.read_pos = match;
+    block_start_length = block.start.S.length;
+    found = 1;
+  } else if (in_buffer.read_pos <= safe_search) {
+    in_buffer.read_pos = safe_search + 1;
+  } else {
+    in_buffer.read_pos++;
+  }
+
+  if (in_buffer.read_pos > in_buffer.stream_end && in_buffer.stream_end != NULL) in_buffer.read_pos--;
+  return found;
+}
+
+/**
+ * find the start of a match of a block delimiter ending at stream offset end, by running the
+ * DFA of the reversed expression back from end. The match starts at or after lower and is
+ * at most REGEX_MATCH_MAX bytes long.
+ * @return stream offset of the first byte of the longest match, -1 if there is none
+ */
+static off_t
+find_match_start(struct regex *r, off_t end, off_t lower) {
+  unsigned char *p, *first;
+  off_t start = -1;
+  int state;
+
+  if (lower < end - REGEX_MATCH_MAX + 1) lower = end - REGEX_MATCH_MAX + 1;
+  if (lower < in_buffer.stream_offset) lower = in_buffer.stream_offset;
+  first = in_buffer.buffer + (lower - in_buffer.stream_offset);
+  p = in_buffer.buffer + (end - in_buffer.stream_offset);
+  state = p == in_buffer.stream_end ? r->bol : r->start;
+  for (; state; p--) {
+    state = r->next[state * r->classes + r->class[*p]];
+    if (r->accept[state] & 1 || (r->accept[state] && p == in_buffer.buffer && !in_buffer.stream_offset))
+      start = in_buffer.stream_offset + (off_t) (p - in_buffer.buffer);
+    if (p == first) break;
+  }
+  return start;
+}
+
+/**
+ * find the first match of a regular expression block delimiter ending at or before last.
+ * The search continues where it was left when key is the same as in the previous search,
+ * otherwise it starts at stream offset lower. Each byte is given once to the DFA, unless
+ * start is not NULL: then the start of the match is put to start, and when the matches
+ * ending at a byte start too far back, the DFA is started again after their start.
+ * @return stream offset of the last byte of the match, -1 if there is none
+ */
+static off_t
+search_delimiter(struct delimiter *d, off_t key, off_t lower, unsigned char *last, off_t *start) {
+  struct regex *r = d->regex;
+  unsigned char *p;
+  off_t end, restart;
+  int state;
+
+  if (key != d->key) {
+    d->key = key;
+    d->lower = lower;
+    d->scan = lower;
+    d->state = lower ? r->start : r->bol;
+  }
+
+  state = d->state;
+  p = in_buffer.buffer + (d->scan - in_buffer.stream_offset);
+  while (p <= last) {
+    state = r->next[state * r->classes + r->class[*p]];
+    if (r->accept[state] & 1 || (r->accept[state] && p == in_buffer.stream_end)) {
+      end = in_buffer.stream_offset + (off_t) (p - in_buffer.buffer);
+      if (start == NULL || (*start = find_match_start(r->reverse, end, d->lower)) >= 0) {
+        d->key = -1;
+        return end;
+      }
+      restart = end - REGEX_MATCH_MAX + 2;        // matches starting before are too long
+      if (restart < d->lower) restart = d->lower;
+      if (restart < in_buffer.stream_offset) restart = in_buffer.stream_offset;
+      p = in_buffer.buffer + (restart - in_buffer.stream_offset);
+      state = restart ? r->start : r->bol;
+      continue;
+    }
+    p++;
+  }
+  d->scan = in_buffer.stream_offset + (off_t) (p - in_buffer.buffer);
+  d->state = state;
+  return -1;
+}
+
+/**
+ * block start at the start of a regular expression match, matches can continue after
+ * safe_search up to the end of the buffer
+ * @return true if a match is found
+ */
+static int
+find_start_regex(unsigned char *safe_search) {
+  off_t current, end, start, resume;
+
+  current = in_buffer.stream_offset + (off_t) (in_buffer.read_pos - in_buffer.buffer);
+  if (in_buffer.stream_end == NULL) safe_search = in_buffer.end - 1;
+  end = search_delimiter(&start_delimiter, current, current, safe_search, &start);
+  if (end >= 0) {
+    in_buffer.read_pos = in_buffer.buffer + (start - in_buffer.stream_offset);
+    block_start_length = end - start + 1;
+    return 1;
+  }
+
+  if (in_buffer.stream_end != NULL) {
+    in_buffer.read_pos = in_buffer.stream_end;
+    return 0;
+  }
+  resume = start_delimiter.scan - REGEX_MATCH_MAX + 1;   // matches not yet found start here or after
+  if (resume < current) resume = current;
+  in_buffer.read_pos = in_buffer.buffer + (resume - in_buffer.stream_offset);
+  start_delimiter.key = resume;
+  return 0;
+}
+
+/**
+ * block starts immediately after the previous block
+ */
+static int
+find_start_next(unsigned char *safe_search) {
+  (void) safe_search;
+  block_start_length = 0;
+  return 1;
+}
+
+/**
+ * block start finder for the block definition, selected in init_buffer
+ */
+static int (*find_start)(unsigned char *safe_search);
+
+/**
+ * block end of fixed length block, no scanning needed
+ */
+static void
+mark_end_length(unsigned char *safe_search) {
+  in_buffer.block_end = in_buffer.read_pos + (block.stop.M - in_buffer.block_offset - 1);
+  if (in_buffer.block_end > safe_search) in_buffer.block_end = NULL;
+}
+
+/**
+ * block end is the end of the stop string
+ */
+static void
+mark_end_stop(unsigned char *safe_search) {
+  unsigned char *scan;
+
+  scan = in_buffer.read_pos;
+  if (in_buffer.block_offset < block_start_length) scan += block_start_length - in_buffer.block_offset;
+  scan = find_pattern(&stop_search, scan, safe_search - block.stop.S.length + 1);
+  in_buffer.block_end = scan != NULL ? scan + block.stop.S.length - 1 : NULL;
+}
+
+/**
+ * block ends just before the start string of the next block
+ */
+static void
+mark_end_start(unsigned char *safe_search) {
+  unsigned char *scan;
+
+  scan = in_buffer.read_pos;
+  if (in_buffer.block_offset < block.start.S.length)          // to skip block start
+    scan += block.start.S.length - in_buffer.block_offset;
+  scan = find_pattern(&start_search, scan, safe_search - block.start.S.length + 1);
+  in_buffer.block_end = scan != NULL ? scan - 1 : NULL;
+}
+
+/**
+ * block end is the end of the stop match
+ */
+static void
+mark_end_stop_regex(unsigned char *safe_search) {
+  off_t block_start, end;
+
+  block_start = in_buffer.stream_offset + (off_t) (in_buffer.read_pos - in_buffer.buffer) - in_buffer.block_offset;
+  end = search_delimiter(&stop_delimiter, block_start, block_start + block_start_length, safe_search, NULL);
+  in_buffer.block_end = end >= 0 ? in_buffer.buffer + (end - in_buffer.stream_offset) : NULL;
+}
+
+/**
+ * block ends just before the start match of the next block
+ */
+static void
+mark_end_start_regex(unsigned char *safe_search) {
+  off_t block_start, start;
+
+  block_start = in_buffer.stream_offset + (off_t) (in_buffer.read_pos - in_buffer.buffer) - in_buffer.block_offset;
+  if (search_delimiter(&stop_delimiter, block_start, block_start + block_start_length, safe_search, &start) >= 0) {
+    in_buffer.block_end = in_buffer.buffer + (start - 1 - in_buffer.stream_offset);
+  } else {
+    in_buffer.block_end = NULL;
+  }
+}
+
+/**
+ * block ends at the end of the stream
+ */
+static void
+mark_end_stream(unsigned char *safe_search) {
+  (void) safe_search;
+  in_buffer.block_end = NULL;
+}
+
+/**
+ * zero size block start and stop
+ */
+static void
+mark_end_zero(unsigned char *safe_search) {
+  (void) safe_search;
+  panic("Both block start and stop zero size", NULL, NULL);
+}
+
+/**
+ * block end marker for the block definition, selected in init_buffer
+ */
+static void (*mark_end)(unsigned char *safe_search);
+
+/**
+ * open the output file
+ */
+void
+set_output_file(char *file) {
+  if (out_stream.file != NULL) panic("Only one output file can be defined", NULL, NULL);
+
+  if (file == NULL) {
+    out_stream.fd = STDOUT_FILENO;
+    out_stream.file = "(stdout)";
+  } else {
+#ifdef WIN32
+    errno_t rc = _sopen_s(&out_stream.fd, file,
+                          _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+                          _SH_DENYNO, _S_IREAD | _S_IWRITE);
+    if (rc != 0) panic("Cannot open for writing", file, strerror(rc));
+#else
+    out_stream.fd = open(file,
+                         O_WRONLY | O_CREAT | O_TRUNC,
+                         S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+
+    if(out_stream.fd == -1) panic("Cannot open for writing",file,strerror(errno));
+#endif
+    out_stream.file = xstrdup(file);
+  }
+}
+
+/**
+ * write output back to the single input file (-i), only bytes which differ from the file are
+ * written. If journal is not NULL, the original bytes are saved to it before they are overwritten.
+ */
+void
+set_in_place_output(char *journal) {
+  struct stat st;
+
+  if (in_stream_start == NULL || in_stream_start->fd == STDIN_FILENO)
+    panic("Option -i needs an input file", NULL, NULL);
+  if (fstat(in_stream_start->fd, &st) == -1) panic("Cannot stat file", in_stream_start->file, strerror(errno));
+  if (!S_ISREG(st.st_mode)) panic("Option -i needs a regular file", in_stream_start->file, NULL);
+
+#ifdef WIN32
+  panic("Option -i is not supported on this platform", NULL, NULL);
+#else
+  out_stream.fd = open(in_stream_start->file, O_RDWR);
+  if (out_stream.fd == -1) panic("Cannot open for writing", in_stream_start->file, strerror(errno));
+  out_stream.file = in_stream_start->file;
+
+  if (journal != NULL) {
+    journal_fd = open(journal,
+                      O_WRONLY | O_CREAT | O_TRUNC,
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+    if (journal_fd == -1) panic("Cannot open for writing", journal, strerror(errno));
+    journal_name = journal;
+  }
+#endif
+  in_place = 1;
+}
+
+/**
+ * @return true if the output is written back to the input file
+ */
+int
+in_place_output() {
+  return in_place;
+}
+
+/**
+ * find the next range of changed bytes after the previous range ending at *end,
+ * ranges closer than IN_PLACE_GAP bytes are joined
+ * @return true if a changed range was found
+ */
+static int
+next_change(unsigned char *buffer, unsigned char *original, off_t length, off_t *start, off_t *end) {
+  off_t i = *end;
+
+  while (i + 64 <= length && !memcmp(buffer + i, original + i, 64)) i += 64;
+  while (i < length && buffer[i] == original[i]) i++;
+  if (i == length) return 0;
+
+  *start = i;
+  *end = i + 1;
+  for (i = *end; i < length && i - *end < IN_PLACE_GAP; i++) {
+    if (buffer[i] != original[i]) *end = i + 1;
+  }
+  return 1;
+}
+
+/**
+ * write to journal file, panic if not all written
+ */
+static void
+write_journal(void *buffer, size_t length) {
+  if (write(journal_fd, buffer, length) != (ssize_t) length)
+    panic("Error writing to", journal_name, strerror(errno));
+}
+
+/**
+ * write output to the input file at the same offset (-i), only the changed bytes are written.
+ * Journal gets the offset and length of each changed range as two off_t values, followed by
+ * the original bytes, and is synced before the file is changed.
+ */
+static void
+write_in_place(unsigned char *buffer, off_t length) {
+  off_t chunk, done, start, end, range[2];
+  ssize_t n;
+
+  if (buffer >= in_buffer.buffer && buffer + length <= in_buffer.end &&
+      in_buffer.stream_offset + (off_t) (buffer - in_buffer.buffer) == output_offset) {
+    output_offset += length;                // input written unchanged
+    return;
+  }
+
+  if (in_place_original == NULL) in_place_original = xmalloc(output_buffer_size);
+
+  while (length > 0) {
+    chunk = length < (off_t) output_buffer_size ? length : (off_t) output_buffer_size;
+    for (done = 0; done < chunk; done += (off_t) n) {
+      n = pread(out_stream.fd, in_place_original + done, (size_t) (chunk - done), output_offset + done);
+      if (n <= 0) panic("Error reading from", out_stream.file, n ? strerror(errno) : NULL);
+    }
+
+    if (journal_fd != -1) {
+      start = end = 0;
+      while (next_change(buffer, in_place_original, chunk, &start, &end)) {
+        range[0] = output_offset + start;
+        range[1] = end - start;
+        write_journal(range, sizeof(range));
+        write_journal(in_place_original + start, (size_t) (end - start));
+      }
+      if (end && fsync(journal_fd) == -1) panic("Error writing to", journal_name, strerror(errno));
+    }
+
+    start = end = 0;
+    while (next_change(buffer, in_place_original, chunk, &start, &end)) {
+      for (done = start; done < end; done += (off_t) n) {
+        n = pwrite(out_stream.fd, buffer + done, (size_t) (end - done), output_offset + done);
+        if (n == -1) panic("Error writing to", out_stream.file, strerror(errno));
+      }
+    }
+
+    buffer += chunk;
+    length -= chunk;
+    output_offset += chunk;
+  }
+}
+
+/**
+ * write to output stream from arbitrary buffer
+ */
+void
+write_output_stream(unsigned char *buffer, ssize_t length) {
+  if (output_sink != NULL) {
+    if (output_sink->length + length > output_sink->size) {
+      output_sink->size = 2 * (output_sink->length + length);
+      output_sink->buffer = xrealloc(output_sink->buffer, output_sink->size);
+    }
+    memcpy(output_sink->buffer + output_sink->length, buffer, length);
+    output_sink->length += length;
+    return;
+  }
+  if (in_place) {
+    write_in_place(buffer, (off_t) length);
+    return;
+  }
+  if (queue_output(buffer, (size_t) length)) return;
+  if (write(out_stream.fd, buffer, length) == -1)
+    panic("Error writing to", out_stream.file, strerror(errno));
+}
+
+
+/**
+ * collect the output of the calling thread to sink, NULL writes to the output stream
+ */
+void
+set_output_sink(struct sink *sink) {
+  output_sink = sink;
+}
+
+/**
+ * open an input file and put it in input file list
+ */
+void
+set_input_file(char *file) {
+  struct io_file *new, *curr;
+
+  new = xmalloc(sizeof(struct io_file));
+  new->next = NULL;
+
+  if (in_stream == NULL) {
+    in_stream = new;
+    in_stream_start = in_stream;
+  } else {
+    curr = in_stream;
+    while (curr->next != NULL) {
+      curr = curr->next;
+    }
+    curr->next = new;
+  }
+
+  new->start_offset = (off_t) 0;
+  new->read_end = (off_t) -1;
+  if (file[0] == '-' && file[1] == 0) {
+    new->fd = STDIN_FILENO;
+    new->file = "(stdin)";
+  } else {
+#ifdef WIN32
+    errno_t rc = _sopen_s(&new->fd, file,
+                          _O_RDONLY | _O_BINARY,
+                          _SH_DENYWR, _S_IREAD);
+    if (rc != 0) panic("Cannot open for reading", file, strerror(rc));
+#else
+    new->fd = open(file,O_RDONLY);
+    if(new->fd == -1) panic("Cannot open file for reading",file,strerror(errno));
+#endif
+    new->file = xstrdup(file);
+  }
+}
+
+/**
+ * return the name of current input file
+ */
+char *
+get_current_file(void) {
+  struct io_file *f = in_stream_start;
+  struct io_file *prev;
+  off_t current_offset = in_buffer.stream_offset + (off_t) (in_buffer.read_pos - in_buffer.buffer);
+
+  if (f == NULL) return "";
+
+  while (f != NULL) {
+    prev = f;
+    f = f->next;
+    if (f != NULL && (f->start_offset == (off_t) 0 || f->start_offset > current_offset)) {
+      f = NULL;
+    }
+  }
+  return prev->file;
+}
+
+
+#ifdef HAVE_SYS_MMAN_H
+
+/**
+ * size of the mapped input file, zero if input is read with read()
+ */
+static off_t map_file_size = 0;
+
+/**
+ * system page size
+ */
+static size_t map_page_size;
+
+/**
+ * descriptor of the mapped input file, kept open until close_input_stream for copying gaps
+ */
+static int map_fd = -1;
+
+/**
+ * check if the input can be mapped instead of read, only a single nonempty regular file is mapped
+ * @return true if input will be mapped
+ */
+static int
+map_input_file() {
+  struct stat st;
+
+  if (in_stream_start == NULL || in_stream_start->next != NULL) return 0;
+  if (fstat(in_stream_start->fd, &st) == -1) return 0;
+  if (!S_ISREG(st.st_mode) || st.st_size == (off_t) 0) return 0;
+
+  map_file_size = st.st_size;
+  map_page_size = (size_t) sysconf(_SC_PAGESIZE);
+  map_fd = in_stream_start->fd;
+  in_buffer.buffer = NULL;
+  return 1;
+}
+
+/**
+ * map the window so that it starts at the page containing stream offset current and
+ * move read_pos to current. One extra page is reserved after the window, so reading
+ * a byte past the end of the stream does not fault.
+ * @return the number of bytes after read_pos in the new window
+ */
+static ssize_t
+map_input_window(off_t current) {
+  off_t window_offset;
+  size_t length;
+  unsigned char *window;
+
+  window_offset = current - current % (off_t) map_page_size;
+  length = INPUT_MAP_WINDOW;
+  if (map_file_size - window_offset < (off_t) length) length = (size_t) (map_file_size - window_offset);
+
+  window = mmap(NULL, length + map_page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (window == MAP_FAILED) panic("Cannot map file", in_stream->file, strerror(errno));
+  if (mmap(window, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, in_stream->fd, window_offset) == MAP_FAILED)
+    panic("Cannot map file", in_stream->file, strerror(errno));
+#ifdef MADV_SEQUENTIAL
+  madvise(window, length, MADV_SEQUENTIAL);
+#endif
+
+  if (in_buffer.buffer != NULL) {
+    if (in_buffer.block_end != NULL)
+      in_buffer.block_end = window + (in_buffer.stream_offset + (in_buffer.block_end - in_buffer.buffer) - window_offset);
+    munmap(in_buffer.buffer, (size_t) (in_buffer.end - in_buffer.buffer) + map_page_size);
+  }
+
+  in_buffer.buffer = window;
+  in_buffer.end = window + length;
+  in_buffer.read_pos = window + (current - window_offset);
+  in_buffer.stream_offset = window_offset;
+
+  if (window_offset + (off_t) length == map_file_size) {
+    in_buffer.stream_end = in_buffer.end - 1;
+    in_buffer.low_pos = in_buffer.end;
+    in_stream = in_stream->next;
+  } else {
+    in_buffer.low_pos = in_buffer.end - input_buffer_low;
+  }
+
+  return (ssize_t) (in_buffer.end - in_buffer.read_pos);
+}
+
+/**
+ * slide the mapped window so that it starts at the page containing read_pos
+ * @return the number of bytes after read_pos in the new window
+ */
+static ssize_t
+map_input_stream() {
+  if (in_buffer.stream_end != NULL) return (ssize_t) 0;  // can't read more
+
+  if (in_buffer.read_pos == NULL) return map_input_window((off_t) 0);
+  return map_input_window(in_buffer.stream_offset + (off_t) (in_buffer.read_pos - in_buffer.buffer));
+}
+
+/**
+ * @return the size of the mapped input file, zero if input is read with read()
+ */
+off_t
+mapped_input_size() {
+  return map_file_size;
+}
+
+/**
+ * map a part of the input file for a worker thread. Bytes from offset to offset + length - 1
+ * are processed as the whole input stream of the thread, block numbers continue from block_num.
+ */
+void
+map_input_part(off_t offset, off_t length, off_t block_num) {
+  off_t part_offset;
+  size_t map_length;
+  unsigned char *window;
+
+  part_offset = offset - offset % (off_t) map_page_size;
+  map_length = (size_t) (offset - part_offset + length);
+
+  window = mmap(NULL, map_length + map_page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (window == MAP_FAILED) panic("Cannot map file", in_stream->file, strerror(errno));
+  if (mmap(window, map_length, PROT_READ, MAP_PRIVATE | MAP_FIXED, in_stream->fd, part_offset) == MAP_FAILED)
+    panic("Cannot map file", in_stream->file, strerror(errno));
+
+  in_buffer.buffer = window + (offset - part_offset);
+  in_buffer.end = in_buffer.buffer + length;
+  in_buffer.read_pos = in_buffer.buffer;
+  in_buffer.low_pos = in_buffer.end;
+  in_buffer.stream_end = in_buffer.end - 1;
+  in_buffer.block_end = NULL;
+  in_buffer.stream_offset = offset;
+  in_buffer.block_offset = 0;
+  in_buffer.block_num = block_num;
+}
+
+/**
+ * unmap the part mapped by map_input_part
+ */
+void
+unmap_input_part() {
+  unsigned char *window;
+
+  window = in_buffer.buffer - in_buffer.stream_offset % (off_t) map_page_size;
+  munmap(window, (size_t) (in_buffer.end - window) + map_page_size);
+}
+
+/**
+ * find all occurrences of a string starting in the first length bytes of the mapped part
+ */
+static void
+find_occurrences(struct search *s, off_t length, struct occurrences *o) {
+  unsigned char *scan, *last, *match;
+
+  o->count = 0;
+  scan = in_buffer.buffer;
+  last = in_buffer.buffer + length - 1;
+  if (last > in_buffer.end - s->pattern->length) last = in_buffer.end - s->pattern->length;
+
+  while ((match = find_pattern(s, scan, last)) != NULL) {
+    if (o->count == o->size) {
+      o->size = o->size ? 2 * o->size : 1024;
+      o->offset = xrealloc(o->offset, o->size * sizeof(unsigned int));
+    }
+    o->offset[o->count++] = (unsigned int) (match - in_buffer.buffer);
+    scan = match + 1;
+  }
+}
+
+/**
+ * find the block start and stop strings starting in a part of the input file, used by
+ * worker threads. Strings may continue after the part.
+ */
+void
+scan_input_part(off_t offset, off_t length, struct occurrences *starts, struct occurrences *stops) {
+  off_t map_length, longest;
+
+  longest = 1;
+  if (block.type & BLOCK_START_S && block.start.S.length > longest) longest = block.start.S.length;
+  if (block.type & BLOCK_STOP_S && block.stop.S.length > longest) longest = block.stop.S.length;
+  map_length = length + longest - 1;
+  if (map_length > map_file_size - offset) map_length = map_file_size - offset;
+
+  map_input_part(offset, map_length, (off_t) 0);
+  starts->count = 0;
+  stops->count = 0;
+  if (block.type & BLOCK_START_S && block.start.S.length) find_occurrences(&start_search, length, starts);
+  if (block.type & BLOCK_STOP_S && block.stop.S.length) find_occurrences(&stop_search, length, stops);
+  unmap_input_part();
+}
+
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SPLICE)
+
+#define COPY_UNKNOWN    0
+#define COPY_NONE       1
+#define COPY_FILE_RANGE 2       // output is a regular file
+#define COPY_SPLICE     3       // output is a pipe
+
+static int copy_mode = COPY_UNKNOWN;
+
+/**
+ * select how the kernel can copy from the input file to the output stream
+ */
+static void
+select_copy_mode() {
+  struct stat st;
+
+  copy_mode = COPY_NONE;
+  if (fstat(out_stream.fd, &st) == -1) return;
+#ifdef HAVE_COPY_FILE_RANGE
+  if (S_ISREG(st.st_mode)) copy_mode = COPY_FILE_RANGE;
+#endif
+#ifdef HAVE_SPLICE
+  if (S_ISFIFO(st.st_mode)) copy_mode = COPY_SPLICE;
+#endif
+}
+
+/**
+ * copy bytes from offset of the mapped input file to the output stream without reading them
+ * to user space. If the kernel does not support copying between the files, copying is not
+ * tried again.
+ * @return number of bytes copied, the rest must be written by the caller
+ */
+static off_t
+copy_input_range(off_t offset, off_t length) {
+  loff_t in_offset = (loff_t) offset;
+  off_t copied = 0;
+  ssize_t n = -1;
+
+  if (map_fd == -1 || in_place) return (off_t) 0;
+  if (copy_mode == COPY_UNKNOWN) select_copy_mode();
+
+  if (copy_mode != COPY_NONE) drain_output();
+  while (copy_mode != COPY_NONE && copied < length) {
+#ifdef HAVE_COPY_FILE_RANGE
+    if (copy_mode == COPY_FILE_RANGE)
+      n = copy_file_range(map_fd, &in_offset, out_stream.fd, NULL, (size_t) (length - copied), 0);
+#endif
+#ifdef HAVE_SPLICE
+    if (copy_mode == COPY_SPLICE)
+      n = splice(map_fd, &in_offset, out_stream.fd, NULL, (size_t) (length - copied), SPLICE_F_MOVE);
+#endif
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      if (copied == 0 && (errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EBADF ||
+                          errno == EOPNOTSUPP || errno == EPERM)) {
+        copy_mode = COPY_NONE;       // e.g. output opened for appending or file system without support
+        break;
+      }
+      panic("Error writing to", out_stream.file, strerror(errno));
+    }
+    if (n == 0) break;
+    copied += (off_t) n;
+  }
+  return copied;
+}
+
+#else
+
+static off_t
+copy_input_range(off_t offset, off_t length) {
+  return (off_t) 0;
+}
+
+#endif
+
+/**
+ * close the mapped input file
+ */
+void
+close_input_stream() {
+  if (map_fd != -1 && close(map_fd) == -1)
+    panic("Error in closing file", in_stream_start->file, strerror(errno));
+}
+
+#else
+
+static int
+map_input_file() {
+  return 0;
+}
+
+static off_t
+copy_input_range(off_t offset, off_t length) {
+  return (off_t) 0;
+}
+
+void
+close_input_stream() {
+}
+
+void
+scan_input_part(off_t offset, off_t length, struct occurrences *starts, struct occurrences *stops) {
+}
+
+off_t
+mapped_input_size() {
+  return (off_t) 0;
+}
+
+void
+map_input_part(off_t offset, off_t length, off_t block_num) {
+}
+
+void
+unmap_input_part() {
+}
+
+#endif
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MEMFD_CREATE)
+
+/**
+ * input ring memory mapped twice back to back, NULL if the buffer is allocated with malloc.
+ * The input buffer is a window of input_buffer_size bytes sliding over the mapping, bytes
+ * at ring + n and ring + ring_size + n are the same.
+ */
+static unsigned char *ring = NULL;
+static size_t ring_size;
+
+/**
+ * map the input ring, buffer size is rounded up to whole pages. With read_ahead the ring
+ * holds INPUT_QUEUE buffers and the reader thread reads the input ahead to it.
+ * @return true if the ring could be mapped
+ */
+static int
+map_input_ring(int read_ahead) {
+  unsigned char *area;
+  size_t page, size;
+  int fd;
+
+  page = (size_t) sysconf(_SC_PAGESIZE);
+  input_buffer_size = (input_buffer_size + page - 1) / page * page;
+  size = read_ahead ? INPUT_QUEUE * input_buffer_size : input_buffer_size;
+
+  fd = memfd_create("bbe", 0);
+  if (fd == -1) return 0;
+  area = MAP_FAILED;
+  if (ftruncate(fd, (off_t) size) == 0)
+    area = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (area != MAP_FAILED &&
+      (mmap(area, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+       mmap(area + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+    munmap(area, 2 * size);
+    area = MAP_FAILED;
+  }
+  close(fd);
+  if (area == MAP_FAILED) return 0;
+#ifdef MADV_HUGEPAGE
+  if (size >= HUGE_BUFFER) madvise(area, 2 * size, MADV_HUGEPAGE);
+#endif
+
+  ring = area;
+  ring_size = size;
+  in_buffer.buffer = ring;
+  if (read_ahead) start_input_reader(in_stream_start, ring, ring_size);
+  return 1;
+}
+
+/**
+ * slide the ring window to start at read_pos, the unread bytes stay in place.
+ * Pointers are moved back to the first mapping when the window starts in the second.
+ * @return where the new bytes are read to
+ */
+static unsigned char *
+slide_input_ring() {
+  off_t moved;
+
+  moved = (off_t) (in_buffer.read_pos - in_buffer.buffer);
+  in_buffer.stream_offset += moved;
+  in_buffer.buffer = in_buffer.read_pos;
+  if (in_buffer.buffer >= ring + ring_size) {
+    in_buffer.buffer -= ring_size;
+    if (in_buffer.block_end != NULL) in_buffer.block_end -= ring_size;
+  }
+  release_input(in_buffer.stream_offset);
+  in_buffer.end = in_buffer.buffer + input_buffer_size;
+  in_buffer.low_pos = in_buffer.end - input_buffer_low;
+  return in_buffer.end - moved;
+}
+
+#else
+
+static int
+map_input_ring(int read_ahead) {
+  return 0;
+}
+
+#endif
+
+/**
+ * set the input buffer low water mark, strings up to longest bytes are searched ahead of the
+ * read position. Buffer is enlarged to hold at least four low water marks.
+ */
+static void
+set_input_low_water(off_t longest) {
+  if (block.type & BLOCK_START_S && block.start.S.length > longest) longest = block.start.S.length;
+  if (block.type & BLOCK_STOP_S && block.stop.S.length > longest) longest = block.stop.S.length;
+  if (block.type & BLOCK_START_R && longest < REGEX_MATCH_MAX) longest = REGEX_MATCH_MAX;
+
+  input_buffer_low = input_buffer_size / BUFFER_LOW_PART;
+  if (input_buffer_low < (size_t) longest + 1) input_buffer_low = (size_t) longest + 1;
+  if (input_buffer_size < 4 * input_buffer_low) input_buffer_size = 4 * input_buffer_low;
+}
+
+/**
+ * initialize in and out buffers, longest is the longest string the commands search
+ * ahead of the read position
+ */
+void
+init_buffer(off_t longest) {
+  in_buffer.read_pos = NULL;
+  in_buffer.stream_end = NULL;
+  in_buffer.stream_offset = (off_t) 0;
+  in_buffer.block_num = 0;
+
+  set_input_low_water(longest);
+  if (!map_input_file()) {
+    seek_input = block.type & BLOCK_START_M && (output_only_block || in_place);
+    if (!map_input_ring(!seek_input)) in_buffer.buffer = xmalloc_buffer(input_buffer_size);
+    in_buffer.end = in_buffer.buffer + input_buffer_size;
+    in_buffer.low_pos = in_buffer.end - input_buffer_low;
+  }
+  if (!in_place) start_output_writer(out_stream.fd, out_stream.file);
+
+  if (block.type & BLOCK_START_S) init_search(&start_search, &block.start.S);
+  if (block.type & BLOCK_STOP_S) init_search(&stop_search, &block.stop.S);
+
+  if (block.type & BLOCK_START_R) {
+    start_delimiter.regex = block.start.R;
+    start_delimiter.key = -1;
+    stop_delimiter.regex = block.start.R;
+  }
+  if (block.type & BLOCK_STOP_R) stop_delimiter.regex = block.stop.R;
+  stop_delimiter.key = -1;
+
+  if (block.type & BLOCK_START_M) {
+    find_start = find_start_number;
+  } else if (block.type & BLOCK_START_R) {
+    find_start = find_start_regex;
+  } else if (block.start.S.length) {
+    find_start = find_start_string;
+  } else {
+    find_start = find_start_next;
+  }
+
+  if (block.type & BLOCK_STOP_M) {
+    mark_end = mark_end_length;
+  } else if (block.type & BLOCK_STOP_R) {
+    mark_end = mark_end_stop_regex;
+  } else if (block.stop.S.length) {
+    mark_end = mark_end_stop;
+  } else if (block.type & BLOCK_START_M) {
+    mark_end = mark_end_stream;
+  } else if (block.type & BLOCK_START_R) {
+    mark_end = mark_end_start_regex;
+  } else if (block.start.S.length) {
+    mark_end = mark_end_start;
+  } else {
+    mark_end = mark_end_zero;
+  }
+
+  init_output_buffer();
+}
+
+/**
+ * allocate the output buffer of the calling thread
+ */
+void
+init_output_buffer() {
+  out_buffer.buffer = xmalloc_buffer(output_buffer_size);
+  out_buffer.end = out_buffer.buffer + output_buffer_size;
+  out_buffer.write_pos = out_buffer.buffer;
+  out_buffer.low_pos = out_buffer.end - output_buffer_size / BUFFER_LOW_PART;
+}
+
+/**
+ * get a new set of bytes for the buffer
+ * @return the number of bytes read.
+ */
+ssize_t
+read_input_stream() {
+  ssize_t read_count, last_read, to_be_read, to_be_saved;
+  unsigned char *buffer_write_pos;
+
+  if (in_buffer.stream_end != NULL) return (ssize_t) 0;  // can't read more
+
+#ifdef HAVE_SYS_MMAN_H
+  if (map_file_size) return map_input_stream();
+#endif
+
+  if (in_buffer.read_pos == NULL)        // first read, so just fill buffer
+  {
+    to_be_read = (ssize_t) input_buffer_size;
+    to_be_saved = 0;
+    buffer_write_pos = in_buffer.buffer;
+  }
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MEMFD_CREATE)
+  else if (ring != NULL)                            // no copying, the window slides over the ring
+  {
+    to_be_read = in_buffer.read_pos - in_buffer.buffer;
+    to_be_saved = (ssize_t) input_buffer_size - to_be_read;
+    buffer_write_pos = slide_input_ring();
+  }
+#endif
+  else                                              //we have already read something
+  {
+    to_be_read = in_buffer.read_pos - in_buffer.buffer;
+    to_be_saved = (ssize_t) input_buffer_size - to_be_read;
+    if (to_be_saved > (ssize_t) input_buffer_size / 2)
+      panic("buffer error: reading to half full buffer", NULL, NULL);
+    memcpy(in_buffer.buffer, in_buffer.read_pos, to_be_saved);    // move "low water" part to beginning of buffer
+    buffer_write_pos = in_buffer.buffer + to_be_saved;
+    in_buffer.stream_offset += (off_t) to_be_read;
+    if (in_buffer.block_end != NULL) in_buffer.block_end -= to_be_read;
+  }
+
+  in_buffer.read_pos = in_buffer.buffer;
+
+  read_count = 0;
+  do {
+    last_read = read_input(in_stream, buffer_write_pos + read_count, (size_t) (to_be_read - read_count));
+    if (last_read == -1) panic("Error reading file", in_stream->file, strerror(errno));
+    if (last_read == 0) {
+      if (close(in_stream->fd) == -1)
+        panic("Error in closing file", in_stream->file, strerror(errno));
+      in_stream = in_stream->next;
+      if (in_stream != NULL)
+        in_stream->start_offset = in_buffer.stream_offset + (off_t) read_count + (off_t) to_be_saved;
+    }
+    read_count += last_read;
+  } while (in_stream != NULL && read_count < to_be_read);
+
+  if (read_count < to_be_read) in_buffer.stream_end = buffer_write_pos + read_count - 1;
+
+  return read_count;
+}
+
+/**
+ * @return byte from the buffer
+ */
+unsigned char
+read_byte() {
+  return *in_buffer.read_pos;
+}
+
+/**
+ * @return pointer to the read position
+ */
+unsigned char *
+read_pos() {
+  return in_buffer.read_pos;
+}
+
+/**
+ * @return the block end pointer
+ */
+unsigned char *
+block_end_pos() {
+  return in_buffer.block_end;
+}
+
+/**
+ * advances the read pointer, if buffer has reached low water, get more from stream to buffer.
+ * @return false in case of end of stream
+ */
+
+int
+get_next_byte() {
+  if (in_buffer.read_pos >= in_buffer.low_pos) {
+    read_input_stream();
+    if (in_buffer.block_end == NULL) mark_block_end();
+  }
+
+  if (in_buffer.stream_end != NULL) {
+    if (in_buffer.read_pos >= in_buffer.stream_end) {
+      return 0;
+    }
+  }
+
+  in_buffer.read_pos++;
+  in_buffer.block_offset++;
+  return 1;
+}
+
+/**
+ * @return pointer to the last byte of the current span, span is the bytes from the read
+ * position up to the block end or the low water mark, whichever is first
+ */
+unsigned char *
+span_end() {
+  unsigned char *last;
+
+  last = in_buffer.block_end;
+  if (last == NULL || (in_buffer.stream_end == NULL && last > in_buffer.low_pos)) last = in_buffer.low_pos;
+  if (last < in_buffer.read_pos) last = in_buffer.read_pos;
+  return last;
+}
+
+/**
+ * advance the read position to last, which is a byte of the current span, and
+ * further to the next byte unless last is the last byte of the block. Buffer is refilled
+ * when the span is used up.
+ * @return false if the block has ended
+ */
+int
+next_span(unsigned char *last) {
+  in_buffer.block_offset += last - in_buffer.read_pos;
+  in_buffer.read_pos = last;
+  if (last_byte()) return 0;
+  get_next_byte();
+  return 1;
+}
+
+/**
+ * check if the eof current block is in buffer and mark it in_buffer.block_end
+ */
+void
+mark_block_end() {
+  unsigned char *safe_search;
+
+  if (in_buffer.stream_end != NULL) {
+    safe_search = in_buffer.stream_end;
+  } else {
+    safe_search = in_buffer.end - 1;
+  }
+
+  mark_end(safe_search);
+
+  if (in_buffer.block_end == NULL && in_buffer.stream_end != NULL)
+    in_buffer.block_end = in_buffer.stream_end;
+}
+
+/**
+ * @return true if current byte is last in block
+ */
+int
+last_byte() {
+  return in_buffer.block_end == in_buffer.read_pos;
+}
+
+/**
+ * @return true (1) if end of stream has been reached
+ */
+static inline int
+end_of_stream() {
+  if (in_buffer.stream_end == NULL) return 0;
+  if (in_buffer.stream_end > in_buffer.read_pos) return 0;
+  return 1;
+}
+
+/**
+ * write bytes between blocks to output stream, long gaps of a mapped input file are
+ * copied by the kernel
+ */
+static void
+write_input_gap(unsigned char *buffer, off_t length) {
+  off_t copied = 0;
+
+  if (length >= INPUT_GAP_COPY && output_sink == NULL)
+    copied = copy_input_range(in_buffer.stream_offset + (off_t) (buffer - in_buffer.buffer), length);
+  if (copied < length) write_output_stream(buffer + copied, length - copied);
+}
+
+/**
+ * move the input stream forward to offset without reading the bytes from the read position
+ * up to offset. The bytes must not be needed in the output, or they are copied by the kernel.
+ * Mapped input is mapped again at offset, other input is seeked within the current file.
+ * @return true if the input was moved
+ */
+static int
+skip_input_stream(off_t offset) {
+  off_t current, buffered, size, copied;
+
+  current = in_buffer.stream_offset + (off_t) (in_buffer.read_pos - in_buffer.buffer);
+  buffered = in_buffer.stream_offset + (off_t) (in_buffer.end - in_buffer.buffer);
+  if (offset <= buffered || in_buffer.stream_end != NULL || in_stream == NULL) return 0;
+  if (out_buffer.write_pos > out_buffer.buffer) flush_buffer();       // output before current
+
+#ifdef HAVE_SYS_MMAN_H
+  if (map_file_size) {
+    if (offset > map_file_size - 1) offset = map_file_size - 1;
+    if (!output_only_block && !in_place) {
+      copied = copy_input_range(current, offset - current);
+      if (copied == 0) return 0;
+      offset = current + copied;
+    }
+    if (in_place) output_offset += offset - current;     // bytes are not changed
+    map_input_window(offset);
+    in_buffer.block_end = NULL;
+    return 1;
+  }
+#endif
+
+  if (!seek_input) return 0;
+
+  size = lseek(in_stream->fd, (off_t) 0, SEEK_END);
+  if (size == -1) return 0;
+  if (offset > in_stream->start_offset + size - 1) offset = in_stream->start_offset + size - 1;
+  if (offset <= buffered) offset = buffered;          // back to where reading was
+  if (lseek(in_stream->fd, offset - in_stream->start_offset, SEEK_SET) == -1)
+    panic("Cannot seek file", in_stream->file, strerror(errno));
+  if (offset == buffered) return 0;
+
+  if (in_place) output_offset += offset - current;
+  in_buffer.stream_offset = offset;
+  in_buffer.read_pos = NULL;
+  in_buffer.block_end = NULL;
+  read_input_stream();
+  return 1;
+}
+
+/**
+ * read for stream to input buffer and advance the read_pos to the start of the buffer
+ * in_buffer.read_pos should point to last byte of previous block
+ */
+int
+find_block() {
+  unsigned char *safe_search, *scan_start;
+  int found, skipped;
+
+  found = 0;
+
+  if (end_of_stream() && last_byte()) return 0;
+
+  if (in_buffer.read_pos == NULL)  // first read
+  {
+    if (!read_input_stream()) return 0;  // zero size input
+  }
+
+  in_buffer.block_offset = 0;
+
+  do {
+    skipped = 0;
+    if (in_buffer.read_pos >= in_buffer.low_pos) read_input_stream();
+
+    if (last_byte()) in_buffer.read_pos++;
+    in_buffer.block_end = NULL;
+
+    scan_start = in_buffer.read_pos;
+
+    if (in_buffer.stream_end != NULL) {
+      safe_search = in_buffer.stream_end;
+    } else {
+      safe_search = in_buffer.low_pos;
+    }
+
+    if (in_buffer.read_pos <= safe_search) {
+      found = find_start(safe_search);
+      if (in_buffer.read_pos > scan_start && !output_only_block) {
+        if (out_buffer.write_pos > out_buffer.buffer) flush_buffer();
+        write_input_gap(scan_start, in_buffer.read_pos - scan_start);
+      }
+      if (found) {
+        mark_block_end();
+      } else if (block.type & BLOCK_START_M) {
+        skipped = skip_input_stream(block.start.N);
+      }
+    }
+  } while (!found && (skipped || !end_of_stream()));
+  if (end_of_stream() && !found && !output_only_block) {
+    if (out_buffer.write_pos > out_buffer.buffer) flush_buffer();
+    write_output_stream(in_buffer.read_pos, 1);
+  }
+  if (found) in_buffer.block_num++;
+  return found;
+}
+
+/**
+ * write null terminated string
+ */
+void
+write_string(char *string) {
+  register char *f;
+
+  f = string;
+
+  while (*f != 0) f++;
+
+  write_buffer(string, (off_t) (f - string));
+}
+
+/**
+ * write_buffer at the current write position
+ */
+void
+write_buffer(unsigned char *buf, off_t length) {
+
+  if (!length) return;
+
+  if (out_buffer.write_pos + length >= out_buffer.end) {
+    if (length >= out_buffer.end - out_buffer.buffer) {     // does not fit to the buffer at all
+      write_input_span(buf, length);
+      return;
+    }
+    flush_buffer();
+  }
+  memcpy(out_buffer.write_pos, buf, length);
+  out_buffer.write_pos += length;
+  out_buffer.block_offset += length;
+}
+
+/**
+ * write the buffered output and a long span to output stream with one gather write
+ */
+static void
+write_output_gather(unsigned char *span, off_t length) {
+#ifdef HAVE_SYS_UIO_H
+  struct iovec iov[2];
+  ssize_t written;
+  int first = 0;
+
+  if (output_sink == NULL && !in_place) {
+    iov[0].iov_base = out_buffer.buffer;
+    iov[0].iov_len = (size_t) (out_buffer.write_pos - out_buffer.buffer);
+    iov[1].iov_base = span;
+    iov[1].iov_len = (size_t) length;
+    if (!iov[0].iov_len) first = 1;
+    drain_output();
+
+    while (first < 2) {
+      written = writev(out_stream.fd, &iov[first], 2 - first);
+      if (written == -1) {
+        if (errno == EINTR) continue;
+        panic("Error writing to", out_stream.file, strerror(errno));
+      }
+      while (first < 2 && (size_t) written >= iov[first].iov_len) written -= (ssize_t) iov[first++].iov_len;
+      if (first < 2) {
+        iov[first].iov_base = (unsigned char *) iov[first].iov_base + written;
+        iov[first].iov_len -= (size_t) written;
+      }
+    }
+    return;
+  }
+#endif
+  write_output_stream(out_buffer.buffer, out_buffer.write_pos - out_buffer.buffer);
+  write_output_stream(span, length);
+}
+
+/**
+ * write a span of the input buffer or other data which stays unchanged, like the contents
+ * of < and > files. Long spans are written directly without copying them to the output buffer.
+ */
+void
+write_input_span(unsigned char *buf, off_t length) {
+  off_t room;
+
+  if (length >= OUTPUT_BUFFER_LOW) {
+    write_output_gather(buf, length);
+    write_w_command(out_buffer.buffer, out_buffer.write_pos - out_buffer.buffer);
+    write_w_command(buf, (size_t) length);
+    out_buffer.write_pos = out_buffer.buffer;
+    out_buffer.block_offset += length;
+    return;
+  }
+
+  while (length > 0) {
+    room = out_buffer.end - out_buffer.write_pos;
+    if (room > length) room = length;
+    memcpy(out_buffer.write_pos, buf, room);
+    out_buffer.write_pos += room;
+    out_buffer.block_offset += room;
+    buf += room;
+    length -= room;
+    if (out_buffer.write_pos >= out_buffer.end) flush_buffer();
+  }
+}
+
+/**
+ * put_byte, put one byte att current write position
+ */
+void
+put_byte(unsigned char byte) {
+  *out_buffer.write_pos = byte;
+}
+
+/**
+ * next_byte, advance the write pointer by one
+ */
+/**
+ * if buffer full write it to disk
+ */
+void
+write_next_byte() {
+  out_buffer.write_pos++;
+  out_buffer.block_offset++;
+  if (out_buffer.write_pos >= out_buffer.end) {
+    flush_buffer();
+  }
+}
+
+/**
+ * write unwritten data from buffer to disk
+ */
+void
+flush_buffer() {
+  unsigned char *spare = NULL;
+
+  write_w_command(out_buffer.buffer, out_buffer.write_pos - out_buffer.buffer);
+  if (output_sink == NULL && !in_place && out_buffer.write_pos > out_buffer.buffer)  // writer thread takes it
+    spare = queue_output_buffer(out_buffer.buffer, (size_t) (out_buffer.write_pos - out_buffer.buffer));
+  if (spare != NULL) {
+    out_buffer.buffer = spare;
+    out_buffer.end = out_buffer.buffer + output_buffer_size;
+    out_buffer.low_pos = out_buffer.end - output_buffer_size / BUFFER_LOW_PART;
+  } else {
+    write_output_stream(out_buffer.buffer, out_buffer.write_pos - out_buffer.buffer);
+  }
+  out_buffer.write_pos = out_buffer.buffer;
+}
+
+/**
+ * close_output_stream
+ */
+void
+close_output_stream() {
+  stop_output_writer();
+  if (in_place && fsync(out_stream.fd) == -1) panic("Error writing to", out_stream.file, strerror(errno));
+  if (close(out_stream.fd) == -1) panic("Error closing output stream", out_stream.file, strerror(errno));
+  if (journal_fd != -1) {                 // file is complete, journal is not needed
+    if (close(journal_fd) == -1) panic("Error closing file", journal_name, strerror(errno));
+    if (unlink(journal_name) == -1) panic("Cannot remove file", journal_name, strerror(errno));
+  }
+}
+
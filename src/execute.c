@@ -1,702 +1,1750 @@
-/* 
- *    bbe - Binary block editor
- *
- *    Copyright (C) 2005 Timo Savinen
- *    This file is part of bbe.
- * 
- *    bbe is free software; you can redistribute it and/or modify
- *    it under the terms of the GNU General Public License as published by
- *    the Free Software Foundation; either version 2 of the License, or
- *    (at your option) any later version.
- *
- *    bbe is distributed in the hope that it will be useful,
- *    but WITHOUT ANY WARRANTY; without even the implied warranty of
- *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *    GNU General Public License for more details.
- *
- *    You should have received a copy of the GNU General Public License
- *    along with bbe; if not, write to the Free Software
- *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
- *
- */
-
-/* $Id: execute.c,v 1.38 2006-03-12 10:05:33 timo Exp $ */
-
-#include "bbe.h"
-#include <stdlib.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <string.h>
-#include <ctype.h>
-
-#ifdef WIN32
-
-#include <share.h>
-
-#endif
-
-/**
- * tells if current byte should be deleted
- */
-static int delete_this_byte;
-
-/**
- * tells if current block should be deleted
- */
-static int delete_this_block;
-
-/**
- * tells if current block should be skipped
- */
-static int skip_this_block;
-
-/**
- * tells if i or s commands are inserting bytes, meaningfull at end of the block
- */
-static int inserting;
-
-/**
- * tells if there is w-command with file having %d this is only for performance
- */
-static int w_commands_block_num = 0;
-
-/**
- * command list for write_w_command
- */
-static struct command_list *current_byte_commands;
-
-/**
- * most significant bit of byte
- */
-#define BYTE_MASK (1 << (sizeof(unsigned char) * 8 - 1))
-
-
-/**
- * byte_to_string, convert byte value to visible string,
- * either hex (H), decimal (D), octal (O) or ascii (A)
- */
-char *
-byte_to_string(unsigned char byte, char format) {
-  static char string[128];
-  int i;
-
-  switch (format) {
-    case 'H':
-      sprintf(string, "x%02x", (int) byte);
-      break;
-    case 'D':
-    case 'K':
-      sprintf(string, "%3d", (int) byte);
-      break;
-    case 'O':
-      sprintf(string, "%03o", (int) byte);
-      break;
-    case 'A':
-      sprintf(string, "%c", isprint(byte) ? byte : ' ');
-      break;
-    case 'B':
-      i = 0;
-      do {
-        string[i] = ((BYTE_MASK >> i) & byte) ? '1' : '0';
-        i++;
-      } while (BYTE_MASK >> i);
-      string[i] = 0;
-      break;
-    default:
-      string[0] = 0;
-      break;
-  }
-  return string;
-}
-
-/**
- * convert off_t to string 
- */
-char *
-off_t_to_string(off_t number, char format) {
-  static char string[128];
-
-  switch (format) {
-    case 'H':
-      sprintf(string, "x%llx", (long long) number);
-      break;
-    case 'D':
-    case 'K':
-      sprintf(string, "%lld", (long long) number);
-      break;
-    case 'O':
-      sprintf(string, "0%llo", (long long) number);
-      break;
-    default:
-      string[0] = 0;
-      break;
-  }
-  return string;
-}
-
-
-#define IO_BLOCK_SIZE (8 * 1024)
-
-/**
- * execute given commands
- */
-void
-execute_commands(struct command_list *c) {
-  register int i;
-  unsigned char a, b;
-  unsigned char *p;
-  char *str;
-  off_t read_count;
-  static unsigned char ioblock[IO_BLOCK_SIZE];
-
-  if (skip_this_block) return;
-
-  while (c != NULL) {
-    switch (c->letter) {
-      case 'A':
-      case 'I':
-        write_buffer(c->s1.string, c->s1.length);
-        break;
-      case 'd':
-        if (c->rpos || c->offset == in_buffer.block_offset) {
-          if (c->rpos < c->count || c->count == 0) {
-            if (inserting) {
-              inserting = 0;
-            } else {
-              delete_this_byte = 1;
-            }
-            c->rpos++;
-          } else {
-            c->rpos = 0;
-          }
-        }
-        break;
-      case 'D':
-        if (c->offset == in_buffer.block_num || c->offset == 0) delete_this_block = 1;
-        break;
-      case 'K':
-        if (c->offset == in_buffer.block_num || c->offset == 0) delete_this_block = 0;
-        break;
-      case 'i':
-        if (c->offset == in_buffer.block_offset && !c->rpos) {
-          c->rpos = 1;
-          inserting = 1;
-          break;
-        }
-        if (c->rpos > 0 && c->rpos <= c->s1.length) {
-          if (c->rpos <= c->s1.length) {
-            put_byte(c->s1.string[c->rpos - 1]);
-            if (delete_this_byte) {
-              delete_this_byte = 0;
-            } else {
-              if (c->rpos < c->s1.length) inserting = 1;
-            }
-          }
-          c->rpos++;
-        }
-        break;
-      case 'r':
-        if (in_buffer.block_offset >= c->offset &&
-            in_buffer.block_offset < c->offset + c->s1.length) {
-          put_byte(c->s1.string[in_buffer.block_offset - c->offset]);
-        }
-        break;
-      case 's':
-        if (c->rpos) {
-          if (c->rpos < c->s1.length && c->rpos < c->s2.length) {
-            put_byte(c->s2.string[c->rpos]);
-          } else if (c->rpos < c->s1.length && c->rpos >= c->s2.length) {
-            if (inserting) {
-              inserting = 0;
-            } else {
-              delete_this_byte = 1;
-            }
-          } else if (c->rpos >= c->s1.length && c->rpos < c->s2.length) {
-            put_byte(c->s2.string[c->rpos]);
-          }
-
-          if (c->rpos >= c->s1.length - 1 && c->rpos < c->s2.length - 1) {
-            if (delete_this_byte) {
-              delete_this_byte = 0;
-            } else {
-              inserting = 1;
-            }
-          }
-
-          c->rpos++;
-          if (c->rpos >= c->s1.length && c->rpos >= c->s2.length) {
-            c->rpos = 0;
-          }
-          break;
-        }
-        if (delete_this_byte) break;
-        if (c->fpos == in_buffer.block_offset) break;
-        p = out_buffer.write_pos;
-        i = 0;
-        while (*p == c->s1.string[i] && i < c->s1.length) {
-          if (p == out_buffer.write_pos) p = read_pos();
-          if (p == block_end_pos() && c->s1.length - 1 > i) break;
-          i++;
-          p++;
-        }
-        if (i == c->s1.length) {
-          c->fpos = in_buffer.block_offset;
-          if (c->s1.length > 1 || c->s2.length > 1) c->rpos = 1;
-          if (c->s2.length) {
-            put_byte(c->s2.string[0]);
-            if (delete_this_byte) {
-              delete_this_byte = 0;
-            } else {
-              if (c->s1.length == 1 && c->s2.length > 1) inserting = 1;
-            }
-          } else {
-            if (inserting) {
-              inserting = 0;
-            } else {
-              delete_this_byte = 1;
-            }
-          }
-        }
-        break;
-      case 't':
-        if (c->rpos)
-          break;
-      case 'y':
-        i = 0;
-        while (c->s1.string[i] != *out_buffer.write_pos && i < c->s1.length) i++;
-        if (c->s1.string[i] == *out_buffer.write_pos && i < c->s1.length) put_byte(c->s2.string[i]);
-        break;
-      case 'c':
-        switch (c->s1.string[0]) {
-          case 'A':                   // from ascii
-            switch (c->s1.string[3]) {
-              case 'B':           // to bcd
-                if (c->rpos || (last_byte() && out_buffer.block_offset == 0))     // skip first nibble
-                {
-                  c->rpos = 0;
-                  if (last_byte())  // unless last byte of block
-                  {
-                    if (*out_buffer.write_pos >= '0' && *out_buffer.write_pos <= '9') {
-                      a = *out_buffer.write_pos - '0';
-                      a = (a << 4) & 0xf0;
-                      b = 0x0f;
-                      *out_buffer.write_pos = a | b;
-                    }
-                  }
-                  break;
-                }
-                if (out_buffer.block_offset == 0 || delete_this_byte) break;
-                if ((out_buffer.write_pos[-1] >= '0' && out_buffer.write_pos[-1] <= '9')) {
-                  a = out_buffer.write_pos[-1] - '0';
-                  a = (a << 4) & 0xf0;
-                  if (*out_buffer.write_pos >= '0' && *out_buffer.write_pos <= '9') {
-                    b = *out_buffer.write_pos - '0';
-                    b &= 0x0f;
-                    delete_this_byte = 1;
-                    c->rpos = 1;
-                  } else {
-                    b = 0x0f;
-                    if (*out_buffer.write_pos == 'F' || *out_buffer.write_pos == 'f') delete_this_byte = 1;
-                  }
-                  out_buffer.write_pos[-1] = a | b;
-                }
-                break;
-            }
-            break;
-          case 'B':               // from bcd
-            switch (c->s1.string[3]) {
-              case 'A':       // to ascii
-                if (((*out_buffer.write_pos >> 4) & 0x0f) <= 9 &&
-                    ((*out_buffer.write_pos & 0x0f) <= 9 || (*out_buffer.write_pos & 0x0f) == 0x0f)) {
-                  a = (*out_buffer.write_pos >> 4) & 0x0f;
-                  b = *out_buffer.write_pos & 0x0f;
-                  *out_buffer.write_pos = '0' + a;
-                  if (!delete_this_byte) {
-                    write_next_byte();
-                    if (b == 0x0f) {
-                      *out_buffer.write_pos = 'F';
-                    } else {
-                      *out_buffer.write_pos = '0' + b;
-                    }
-                  }
-                }
-                break;
-            }
-            break;
-        }
-        break;
-      case 'j':
-        if (in_buffer.block_offset < c->count) {
-          while (c->next != NULL) c = c->next;     // skip rest of commands
-        }
-        break;
-      case 'J':
-        if (in_buffer.block_num <= c->count) {
-          skip_this_block = 1;
-          return;
-        }
-        break;
-      case 'l':
-        if (in_buffer.block_offset >= c->count) {
-          while (c->next != NULL) c = c->next;     // skip rest of commands
-        }
-        break;
-      case 'L':
-        if (in_buffer.block_num > c->count) {
-          skip_this_block = 1;
-          return;
-        }
-        break;
-      case 'p':
-        if (delete_this_byte) break;
-        i = 0;
-        a = *out_buffer.write_pos;
-        while (i < c->s1.length) {
-          str = byte_to_string(a, c->s1.string[i]);
-          write_string(str);
-          i++;
-          if (i < c->s1.length) {
-            put_byte('-');
-            write_next_byte();
-          }
-        }
-        put_byte(' ');
-        break;
-      case 'F':
-        str = off_t_to_string(in_buffer.stream_offset + (off_t) (in_buffer.read_pos - in_buffer.buffer),
-                              c->s1.string[0]);
-        write_string(str);
-        put_byte(':');
-        write_next_byte();
-        break;
-      case 'B':
-        str = off_t_to_string(in_buffer.block_num, c->s1.string[0]);
-        write_string(str);
-        put_byte(':');
-        write_next_byte();
-        break;
-      case 'N':
-        write_string(get_current_file());
-        put_byte(':');
-        write_next_byte();
-        break;
-      case '&':
-        put_byte(*out_buffer.write_pos & c->s1.string[0]);
-        break;
-      case '|':
-        put_byte(*out_buffer.write_pos | c->s1.string[0]);
-        break;
-      case '^':
-        put_byte(*out_buffer.write_pos ^ c->s1.string[0]);
-        break;
-      case '~':
-        put_byte(~*out_buffer.write_pos);
-        break;
-      case '<':
-      case '>':
-        if (fseeko(c->fd, 0, SEEK_SET)) panic("Cannot seek file", c->s1.string, strerror(errno));
-        do {
-          read_count = fread(ioblock, 1, IO_BLOCK_SIZE, c->fd);
-          write_buffer(ioblock, read_count);
-        } while (read_count);
-        break;
-      case 'u':
-        if (in_buffer.block_offset <= c->offset) {
-          put_byte(c->s1.string[0]);
-        }
-        break;
-      case 'f':
-        if (in_buffer.block_offset >= c->offset) {
-          put_byte(c->s1.string[0]);
-        }
-        break;
-      case 'w':
-        break;
-      case 'x':
-        put_byte(((*out_buffer.write_pos << 4) & 0xf0) | ((*out_buffer.write_pos >> 4) & 0x0f));
-        break;
-    }
-    c = c->next;
-  }
-}
-
-/**
- * write w command, will be called when output_buffer is written, same will be written to w-command files
- */
-void
-write_w_command(unsigned char *buf, size_t length) {
-  struct command_list *c;
-
-  if (skip_this_block) return;
-
-  c = current_byte_commands;
-
-  while (c != NULL) {
-    if (c->letter == 'w') {
-      if (fwrite(buf, 1, length, c->fd) != length) panic("Cannot write to file", c->s2.string, strerror(errno));
-      if (length) c->count = 1;    // file was written
-    }
-    c = c->next;
-  }
-}
-
-/**
- * finds the %B or %nB format string from the filename of w-command
- * @return pointer to %-position and the length of the format string
- */
-char *
-find_block_w_file(char *file, int *len) {
-  char *f, *ppos;
-
-  f = file;
-
-  while (*f != 0) {
-    if (*f == '%') {
-      ppos = f;
-      f++;
-      while (f - ppos < 4 && isdigit(*f)) f++;
-      if (*f == 'B') {
-        *len = (int) (f - ppos) + 1;
-        return ppos;
-      }
-      f = ppos;
-    }
-    f++;
-  }
-  return NULL;
-}
-
-/**
- * replaces all %B or %nB format strings with block number in a file name
- */
-void
-bn_printf(char *file, char *str, off_t block_number) {
-  char *bstart, *f;
-  char num[128], format[64];
-  int blen;
-
-  f = str;
-  file[0] = 0;
-
-  while ((bstart = find_block_w_file(f, &blen)) != NULL) {
-    num[0] = 0;
-    format[0] = 0;
-    strncat(file, f, bstart - f);
-    strncpy(format, bstart, blen - 1);
-    format[blen - 1] = 0;
-    strcat(format, "lld");
-    sprintf(num, format, (long long) block_number);
-    if (strlen(file) + strlen(num) >= 4096) panic("Filename for w-command too long", str, NULL);
-    strcat(file, num);
-    f = bstart + blen;
-  }
-  strcat(file, f);
-}
-
-/**
- * close (if open) and open next w-command files for new block
- */
-void
-open_w_files(off_t block_number) {
-  struct command_list *c;
-  static char file[4096];
-
-  c = current_byte_commands;
-
-  while (c != NULL) {
-    if (c->letter == 'w' && c->offset) {
-      if (c->fd != NULL) {
-        if (fclose(c->fd) != 0) panic("Error closing file", c->s2.string, strerror(errno));
-        if (!c->count && c->s2.string != NULL)  // remove if empty
-        {
-          unlink(c->s2.string);
-        }
-        c->fd = NULL;
-      }
-
-      bn_printf(file, c->s1.string, block_number);
-
-#ifdef WIN32
-      errno_t rc = fopen_s(&c->fd, file, "wb");
-      if (rc != 0) panic("Cannot open file for writing", file, strerror(rc));
-#else
-      c->fd = fopen(file,"w");
-      if(c->fd == NULL) panic("Cannot open file for writing",file,strerror(errno));
-#endif
-      c->count = 0;
-      if (c->s2.string != NULL) free(c->s2.string);
-      c->s2.string = xstrdup(file);
-    }
-    c = c->next;
-  }
-}
-
-
-/**
- * init_commands, initialize those which need it, currently w - open file and rpos=0 for all
- */
-void
-init_commands(struct commands *commands) {
-  struct command_list *c;
-  int wlen;
-
-  c = commands->byte;
-
-  while (c != NULL) {
-    switch (c->letter) {
-      case 'w':
-        if (find_block_w_file(c->s1.string, &wlen) != NULL) {
-          c->fd = NULL;
-          c->offset = 1;
-          w_commands_block_num = 1;
-          c->s2.string = NULL;
-        } else {
-#ifdef WIN32
-          errno_t rc = fopen_s(&c->fd, c->s1.string, "wb");
-          if (rc != 0) panic("Cannot open file for writing", c->s1.string, strerror(rc));
-#else
-          c->fd = fopen(c->s1,"w");
-          if(c->fd == NULL) panic("Cannot open file for writing",c->s1,strerror(errno));
-#endif
-          c->offset = 0;
-          c->s2.string = xstrdup(c->s1.string);
-        }
-        c->count = 0;
-        break;
-    }
-    c = c->next;
-  }
-
-  c = commands->block_start;
-
-  while (c != NULL) {
-    switch (c->letter) {
-      case '>': {
-#ifdef WIN32
-        errno_t rc = fopen_s(&c->fd, c->s1.string, "rb");
-        if (rc != 0) panic("Cannot open for reading", c->s1.string, strerror(rc));
-#else
-        c->fd = fopen(c->s1,"r");
-        if(c->fd == NULL) panic("Cannot open file for reading",c->s1,strerror(errno));
-#endif
-      }
-        break;
-    }
-    c = c->next;
-  }
-
-  c = commands->block_end;
-
-  while (c != NULL) {
-    switch (c->letter) {
-      case '<': {
-#ifdef WIN32
-        errno_t rc = fopen_s(&c->fd, c->s1.string, "rb");
-        if (rc != 0) panic("Cannot open for reading", c->s1.string, strerror(rc));
-#else
-        c->fd = fopen(c->s1,"r");
-        if(c->fd == NULL) panic("Cannot open file for reading",c->s1,strerror(errno));
-#endif
-      }
-        break;
-    }
-    c = c->next;
-  }
-
-}
-
-
-/**
- * close_commands, close those wich need it, currently w - close file
- */
-void
-close_commands(struct commands *commands) {
-  struct command_list *c;
-
-  c = commands->byte;
-
-  while (c != NULL) {
-    switch (c->letter) {
-      case 'w':
-        if (c->fd != NULL) {
-          if (fclose(c->fd) != 0) panic("Error in closing file", c->s2.string, strerror(errno));
-          if (!c->count && c->s2.string != NULL) {
-            unlink(c->s2.string);
-          }
-        }
-        break;
-    }
-    c = c->next;
-  }
-
-  c = commands->block_start;
-
-  while (c != NULL) {
-    switch (c->letter) {
-      case '>':
-        fclose(c->fd);
-        break;
-    }
-    c = c->next;
-  }
-
-  c = commands->block_end;
-
-  while (c != NULL) {
-    switch (c->letter) {
-      case '<':
-        fclose(c->fd);
-        break;
-    }
-    c = c->next;
-  }
-}
-
-/**
- * reset the rpos counter for next block, in case block was shorter eg. delete count
- */
-static inline void
-reset_rpos(struct command_list *c) {
-  while (c != NULL) {
-    c->rpos = 0;
-    c->fpos = -1;
-    c = c->next;
-  }
-}
-
-
-/**
- * main execution loop
- */
-void
-execute_program(struct commands *commands) {
-  int block_end;
-
-  current_byte_commands = commands->byte;
-
-  while (find_block()) {
-    reset_rpos(commands->byte);
-    delete_this_block = 0;
-    if (commands->block_start != NULL && commands->block_start->letter == 'K') {
-      delete_this_block = 1;
-    }
-    out_buffer.block_offset = 0;
-    skip_this_block = 0;
-    if (w_commands_block_num) open_w_files(in_buffer.block_num);
-    execute_commands(commands->block_start);
-    do {
-      delete_this_byte = 0;
-      inserting = 0;
-      block_end = last_byte();
-      put_byte(read_byte());     // as default write current byte from input
-      execute_commands(commands->byte);
-      if (!delete_this_byte && !delete_this_block) {
-        write_next_byte();           // advance the write pointer if byte is not marked for del
-      }
-      if (!block_end && !inserting) get_next_byte();
-    } while (!block_end || inserting);
-    execute_commands(commands->block_end);
-    flush_buffer();
-  }
-  close_output_stream();
-}
+/* 
+ *    bbe - Binary block editor
+ *
+ *    Copyright (C) 2005 Timo Savinen
+ *    This file is part of bbe.
+ * 
+ *    bbe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    bbe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with bbe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* $Id: execute.c,v 1.38 2006-03-12 10:05:33 timo Exp $ */
+
+#include "bbe.h"
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef WIN32
+
+#include <share.h>
+
+#endif
+
+/**
+ * tells if current byte should be deleted
+ */
+static THREAD_LOCAL int delete_this_byte;
+
+/**
+ * tells if current block should be deleted
+ */
+static THREAD_LOCAL int delete_this_block;
+
+/**
+ * tells if current block should be skipped
+ */
+static THREAD_LOCAL int skip_this_block;
+
+/**
+ * tells if i or s commands are inserting bytes, meaningfull at end of the block
+ */
+static THREAD_LOCAL int inserting;
+
+/**
+ * tells if there is w-command with file having %d this is only for performance
+ */
+static int w_commands_block_num = 0;
+
+/**
+ * tells if there are w-commands, the output buffer is then flushed at the end of every block
+ */
+static int w_commands = 0;
+
+/**
+ * blocks after this one don't write output (-s) or change the file (-i), the rest of the
+ * input is not read. -1 if any block can.
+ */
+off_t last_live_block = -1;
+
+/**
+ * command list for write_w_command
+ */
+static struct command_list *current_byte_commands;
+
+/**
+ * most significant bit of byte
+ */
+#define BYTE_MASK (1 << (sizeof(unsigned char) * 8 - 1))
+
+
+/**
+ * byte_to_string, convert byte value to visible string,
+ * either hex (H), decimal (D), octal (O) or ascii (A)
+ */
+char *
+byte_to_string(unsigned char byte, char format) {
+  static THREAD_LOCAL char string[128];
+  int i;
+
+  switch (format) {
+    case 'H':
+      sprintf(string, "x%02x", (int) byte);
+      break;
+    case 'D':
+    case 'K':
+      sprintf(string, "%3d", (int) byte);
+      break;
+    case 'O':
+      sprintf(string, "%03o", (int) byte);
+      break;
+    case 'A':
+      sprintf(string, "%c", isprint(byte) ? byte : ' ');
+      break;
+    case 'B':
+      i = 0;
+      do {
+        string[i] = ((BYTE_MASK >> i) & byte) ? '1' : '0';
+        i++;
+      } while (BYTE_MASK >> i);
+      string[i] = 0;
+      break;
+    default:
+      string[0] = 0;
+      break;
+  }
+  return string;
+}
+
+/**
+ * convert off_t to string 
+ */
+char *
+off_t_to_string(off_t number, char format) {
+  static THREAD_LOCAL char string[128];
+
+  switch (format) {
+    case 'H':
+      sprintf(string, "x%llx", (long long) number);
+      break;
+    case 'D':
+    case 'K':
+      sprintf(string, "%lld", (long long) number);
+      break;
+    case 'O':
+      sprintf(string, "0%llo", (long long) number);
+      break;
+    default:
+      string[0] = 0;
+      break;
+  }
+  return string;
+}
+
+
+/**
+ * execute given block commands
+ */
+void
+execute_commands(struct command_list *c) {
+  char *str;
+
+  if (skip_this_block) return;
+
+  while (c != NULL) {
+    switch (c->letter) {
+      case 'A':
+      case 'I':
+        write_buffer(c->s1.string, c->s1.length);
+        break;
+      case 'D':
+        if (c->offset == in_buffer.block_num || c->offset == 0) delete_this_block = 1;
+        break;
+      case 'K':
+        if (c->offset == in_buffer.block_num || c->offset == 0) delete_this_block = 0;
+        break;
+      case 'J':
+        if (in_buffer.block_num <= c->count) {
+          skip_this_block = 1;
+          return;
+        }
+        break;
+      case 'L':
+        if (in_buffer.block_num > c->count) {
+          skip_this_block = 1;
+          return;
+        }
+        break;
+      case 'F':
+        str = off_t_to_string(in_buffer.stream_offset + (off_t) (in_buffer.read_pos - in_buffer.buffer),
+                              c->s1.string[0]);
+        write_string(str);
+        put_byte(':');
+        write_next_byte();
+        break;
+      case 'B':
+        str = off_t_to_string(in_buffer.block_num, c->s1.string[0]);
+        write_string(str);
+        put_byte(':');
+        write_next_byte();
+        break;
+      case 'N':
+        write_string(get_current_file());
+        put_byte(':');
+        write_next_byte();
+        break;
+      case '<':
+      case '>':
+        write_input_span(c->s2.string, c->s2.length);
+        break;
+    }
+    c = c->next;
+  }
+}
+
+/**
+ * op codes of the compiled byte commands, order must match the label table in run_program
+ */
+#define OP_END       0
+#define OP_DELETE    1     // d
+#define OP_INSERT    2     // i
+#define OP_REPLACE   3     // r
+#define OP_SUBST     4     // s
+#define OP_REGEX     5     // t
+#define OP_TABLE     6     // y, &, |, ^, ~ and x
+#define OP_ASC_BCD   7     // c ASC BCD
+#define OP_BCD_ASC   8     // c BCD ASC
+#define OP_SKIP_LOW  9     // j
+#define OP_SKIP_HIGH 10    // l
+#define OP_PRINT     11    // p
+#define OP_UNTIL     12    // u
+#define OP_FROM      13    // f
+#define OP_SUBSTS    14    // group of s commands following this op
+#define OP_MSUBST    15    // s with a masked search string
+
+/**
+ * byte commands compiled to a flat array, terminated by OP_END
+ */
+static struct op *compiled_program;
+
+/**
+ * program of the current thread, commands keep their state in it
+ */
+static THREAD_LOCAL struct op *program;
+
+/**
+ * tells if program is a single translation table, blocks are then translated span by span
+ */
+static int table_program;
+
+/**
+ * tells if program writes output also for deleted blocks (p and c commands)
+ */
+static int deleted_block_output;
+
+/**
+ * tells if program has only commands which act on fixed block offsets or on every byte
+ * alike (d, i, r, u, f, j, l and translations), such a program is run by scheduling
+ */
+static int scheduled_program;
+
+/**
+ * translate length bytes from "from" to "to" with table
+ */
+static void
+translate_scalar(unsigned char *table, unsigned char *from, unsigned char *to, size_t length) {
+  while (length >= 4) {
+    to[0] = table[from[0]];
+    to[1] = table[from[1]];
+    to[2] = table[from[2]];
+    to[3] = table[from[3]];
+    from += 4;
+    to += 4;
+    length -= 4;
+  }
+  while (length--) *to++ = table[*from++];
+}
+
+#ifdef HAVE_X86_SIMD
+
+/**
+ * translate 64 bytes at a time with vpermi2b, both halves of the table are looked up by the
+ * low seven bits and the result is selected by the high bit. Splitting the table by nibbles
+ * for pshufb needs 16 lookups and 15 blends per vector, which is slower than the plain table
+ * lookup, so there is no SSE or AVX2 kernel.
+ */
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static void
+translate_vbmi(unsigned char *table, unsigned char *from, unsigned char *to, size_t length) {
+  __m512i t0 = _mm512_loadu_si512((void *) table);
+  __m512i t1 = _mm512_loadu_si512((void *) (table + 64));
+  __m512i t2 = _mm512_loadu_si512((void *) (table + 128));
+  __m512i t3 = _mm512_loadu_si512((void *) (table + 192));
+  __m512i v;
+
+  while (length >= 64) {
+    v = _mm512_loadu_si512((void *) from);
+    _mm512_storeu_si512((void *) to, _mm512_mask_blend_epi8(_mm512_movepi8_mask(v),
+                                                             _mm512_permutex2var_epi8(t0, v, t1),
+                                                             _mm512_permutex2var_epi8(t2, v, t3)));
+    from += 64;
+    to += 64;
+    length -= 64;
+  }
+  translate_scalar(table, from, to, length);
+}
+#endif
+
+/**
+ * translation kernel, selected in compile_commands
+ */
+static void (*translate)(unsigned char *table, unsigned char *from, unsigned char *to, size_t length) = translate_scalar;
+
+/**
+ * translate bytes from the input to the output buffer
+ */
+static void
+translate_buffer(unsigned char *table, unsigned char *from, off_t length) {
+  off_t room;
+
+  while (length > 0) {
+    room = out_buffer.end - out_buffer.write_pos;
+    if (room > length) room = length;
+    translate(table, from, out_buffer.write_pos, (size_t) room);
+    out_buffer.write_pos += room;
+    out_buffer.block_offset += room;
+    from += room;
+    length -= room;
+    if (out_buffer.write_pos >= out_buffer.end) flush_buffer();
+  }
+}
+
+/**
+ * process the rest of the block one buffered span at a time, the span is translated with table
+ * or copied as is if table is NULL. Deleted blocks are passed over without writing.
+ */
+static void
+copy_block(unsigned char *table) {
+  unsigned char *last;
+  off_t length;
+
+  do {
+    last = span_end();
+    length = (off_t) (last - in_buffer.read_pos) + 1;
+
+    if (!delete_this_block) {
+      if (table == NULL) {
+        write_input_span(in_buffer.read_pos, length);
+      } else {
+        translate_buffer(table, in_buffer.read_pos, length);
+      }
+    }
+  } while (next_span(last));
+}
+
+/**
+ * smallest window of input offsets in the member sets of OP_SUBSTS, the input is scanned
+ * ahead up to the window
+ */
+#define SUBSTS_WINDOW 256
+
+/**
+ * shortest search string of a single s command found with an automaton, comparing shorter
+ * strings at every byte is faster
+ */
+#define SUBST_LONG 16
+
+/**
+ * bits in a word of the member sets of OP_SUBSTS
+ */
+#define MEMBER_BITS (8 * (int) sizeof(unsigned long))
+
+/**
+ * @return number of words in a member set of OP_SUBSTS op
+ */
+#define MEMBER_WORDS(op) (((int) (op)->count + MEMBER_BITS - 1) / MEMBER_BITS)
+
+/**
+ * mark member of a group of s commands replacing or not replacing, see group_substs()
+ */
+static inline void
+set_replacing(struct op *op, int replacing) {
+  struct op *head;
+  unsigned long *word;
+  int member;
+
+  if (!op->count) return;
+  head = op - op->count;
+  member = (int) op->count - 1;
+  word = head->members + head->length * MEMBER_WORDS(head) + member / MEMBER_BITS;
+  if (replacing) {
+    *word |= 1UL << (member % MEMBER_BITS);
+    head->rpos++;
+  } else {
+    *word &= ~(1UL << (member % MEMBER_BITS));
+    head->rpos--;
+  }
+}
+
+/**
+ * replace the next byte of a match of s or t command, op->rpos bytes of op->length bytes
+ * matched are replaced by the op->length2 bytes of op->string2
+ */
+static inline void
+replace_next(struct op *op) {
+  if (op->rpos < op->length && op->rpos < op->length2) {
+    put_byte(op->string2[op->rpos]);
+  } else if (op->rpos < op->length && op->rpos >= op->length2) {
+    if (inserting) {
+      inserting = 0;
+    } else {
+      delete_this_byte = 1;
+    }
+  } else if (op->rpos >= op->length && op->rpos < op->length2) {
+    put_byte(op->string2[op->rpos]);
+  }
+
+  if (op->rpos >= op->length - 1 && op->rpos < op->length2 - 1) {
+    if (delete_this_byte) {
+      delete_this_byte = 0;
+    } else {
+      inserting = 1;
+    }
+  }
+
+  op->rpos++;
+  if (op->rpos >= op->length && op->rpos >= op->length2) {
+    op->rpos = 0;
+    set_replacing(op, 0);
+  }
+}
+
+/**
+ * start replacing a match of s or t command found at current byte
+ */
+static inline void
+replace_first(struct op *op) {
+  op->fpos = in_buffer.block_offset;
+  if (op->length > 1 || op->length2 > 1) {
+    op->rpos = 1;
+    set_replacing(op, 1);
+  }
+  if (op->length2) {
+    put_byte(op->string2[0]);
+    if (delete_this_byte) {
+      delete_this_byte = 0;
+    } else {
+      if (op->length == 1 && op->length2 > 1) inserting = 1;
+    }
+  } else {
+    if (inserting) {
+      inserting = 0;
+    } else {
+      delete_this_byte = 1;
+    }
+  }
+}
+
+/**
+ * s command for current byte, compares the search string to the output byte and the input
+ * after it. When tail is set, the input after the read position is known to match the search
+ * string after its first byte, and only the output byte and the block end are checked.
+ */
+static inline void
+subst(struct op *op, int tail) {
+  register int i;
+  unsigned char *p;
+
+  if (op->rpos) {
+    replace_next(op);
+    return;
+  }
+  if (delete_this_byte) return;
+  if (op->fpos == in_buffer.block_offset) return;
+  if (tail) {
+    i = *out_buffer.write_pos == op->string[0] ? op->length : 0;
+    if (in_buffer.block_end != NULL && in_buffer.block_end - in_buffer.read_pos < op->length - 1) i = 0;
+  } else {
+    p = out_buffer.write_pos;
+    i = 0;
+    while (i < op->length && *p == op->string[i]) {
+      if (p == out_buffer.write_pos) p = read_pos();
+      if (p == block_end_pos() && op->length - 1 > i) break;
+      i++;
+      p++;
+    }
+  }
+  if (i == op->length) replace_first(op);
+}
+
+/**
+ * s command with a masked search string for current byte, compares the bits of the output
+ * byte and the input after it under the mask of the search string
+ */
+static void
+masked_subst(struct op *op) {
+  register int i;
+  unsigned char *p;
+
+  if (op->rpos) {
+    replace_next(op);
+    return;
+  }
+  if (delete_this_byte) return;
+  if (op->fpos == in_buffer.block_offset) return;
+  p = out_buffer.write_pos;
+  i = 0;
+  while (i < op->length && (*p & op->mask[i]) == op->string[i]) {
+    if (p == out_buffer.write_pos) p = read_pos();
+    if (p == block_end_pos() && op->length - 1 > i) break;
+    i++;
+    p++;
+  }
+  if (i == op->length) replace_first(op);
+}
+
+/**
+ * t command for current byte, runs the DFA of the regular expression over the output byte and
+ * the input after it, and replaces the longest match starting at the byte. Empty matches are
+ * not replaced. The input is searched once ahead for the bytes a match can end with, and the
+ * DFA is not run past the last of them.
+ */
+static inline void
+regex_subst(struct op *op) {
+  struct regex *r = op->regex;
+  unsigned char *p, *last, *end;
+  off_t current, length;
+  int state;
+
+  if (op->rpos) {
+    replace_next(op);
+    return;
+  }
+  if (delete_this_byte) return;
+  if (op->fpos == in_buffer.block_offset) return;
+
+  state = in_buffer.block_offset ? r->start : r->bol;
+  state = r->next[state * r->classes + r->class[*out_buffer.write_pos]];
+  if (!state) return;
+  end = in_buffer.block_end;                      // block end is after the buffer if not known
+  last = end;
+  if (last == NULL || last - in_buffer.read_pos >= REGEX_MATCH_MAX) last = in_buffer.read_pos + REGEX_MATCH_MAX - 1;
+
+  current = in_buffer.stream_offset + (off_t) (in_buffer.read_pos - in_buffer.buffer);
+  if (current >= op->scan) {                      // bytes after the read position were not searched
+    op->scan = current + 1;
+    op->ending = current;
+  }
+  for (p = in_buffer.buffer + (op->scan - in_buffer.stream_offset); p <= last; p++, op->scan++) {
+    if (r->ending[*p]) op->ending = op->scan;
+  }
+  if (op->ending <= current) {                    // the match can't continue after the first byte
+    last = in_buffer.read_pos;
+  } else if (op->ending - current < last - in_buffer.read_pos) {
+    last = in_buffer.read_pos + (op->ending - current);
+  }
+
+  length = r->accept[state] & 1 || (r->accept[state] && in_buffer.read_pos == end) ? 1 : 0;
+  for (p = in_buffer.read_pos + 1; p <= last && state; p++) {
+    state = r->next[state * r->classes + r->class[*p]];
+    if (r->accept[state] & 1 || (r->accept[state] && p == end)) length = p - in_buffer.read_pos + 1;
+  }
+  if (!length) return;
+
+  op->length = length;
+  op->length2 = expand_replacement(r, *out_buffer.write_pos, in_buffer.read_pos + 1, length,
+                                   (in_buffer.block_offset ? 0 : REGEX_BOL) |
+                                   (in_buffer.read_pos + length - 1 == end ? REGEX_EOL : 0), op->string2);
+  replace_first(op);
+}
+
+/**
+ * mark the members of OP_SUBSTS op whose search string ends in state of the automaton at
+ * input offset scan as candidates, if they start at or after offset current
+ */
+static inline void
+mark_candidates(struct op *op, int state, off_t scan, off_t current) {
+  struct automaton *a = op->automaton;
+  off_t start;
+  int words, i, m;
+
+  words = MEMBER_WORDS(op);
+  for (i = a->output_start[state]; i < a->output_end[state]; i++) {
+    m = a->matches[i];
+    start = scan - (op[1 + m].length - 1);
+    if (start < current) continue;
+    op->members[(start & (op->length - 1)) * words + m / MEMBER_BITS] |= 1UL << (m % MEMBER_BITS);
+  }
+}
+
+/**
+ * give the input after the scan position of a OP_SUBSTS op to the automaton of the group,
+ * when it is not scanned up to the longest search string after the read position. Search
+ * strings are given to the automaton without their first byte, which is compared to the
+ * output, so a string of member m found ending at offset e marks member m as a candidate at
+ * offset e - length of the string.
+ * @return stream offset of the read position
+ */
+static inline off_t
+scan_substs(struct op *op) {
+  struct automaton *a = op->automaton;
+  unsigned char *p, *last, *class = a->class;
+  int *next = a->next;
+  off_t current, scan, mask, n, row;
+  int state, words;
+
+  current = in_buffer.stream_offset + (off_t) (in_buffer.read_pos - in_buffer.buffer);
+  if (current >= op->scan) {                      // bytes before were not scanned
+    op->scan = current;
+    op->state = 0;
+  }
+  if (op->scan > current + a->longest) return current;
+
+  mask = op->length - 1;                          // scan ahead as far as the window allows
+  last = in_buffer.block_end;                     // strings can't continue to the next block
+  if (last == NULL) last = in_buffer.stream_end != NULL ? in_buffer.stream_end : in_buffer.end - 1;
+  if (last - in_buffer.read_pos > mask) last = in_buffer.read_pos + mask;
+
+  scan = op->scan;
+  p = in_buffer.buffer + (scan - in_buffer.stream_offset);
+  if (p > last) return current;
+
+  words = MEMBER_WORDS(op);
+  n = last - p + 1;                               // clear the sets of the offsets scanned
+  row = scan & mask;
+  if (row + n > op->length) {
+    memset(op->members, 0, (size_t) (row + n - op->length) * words * sizeof(unsigned long));
+    n = op->length - row;
+  }
+  memset(op->members + row * words, 0, (size_t) n * words * sizeof(unsigned long));
+
+  state = op->state;
+  if (next != NULL) {
+    for (; p <= last; p++, scan++) {
+      state = next[state + class[*p]];
+      if (state < 0) {
+        state = ~state;
+        mark_candidates(op, state >> a->shift, scan, current);
+      }
+    }
+  } else {                                        // one long string, state is the bytes matched
+    for (; p <= last; p++, scan++) {
+      if (state == a->longest) state = a->fail[state];
+      while (state && a->string[state] != *p) state = a->fail[state];
+      if (a->string[state] == *p) state++;
+      if (state == a->longest) mark_candidates(op, state, scan, current);
+    }
+  }
+  op->state = state;
+  op->scan = scan;
+  return current;
+}
+
+/**
+ * run the members of a group of s commands which are replacing or may match at the read
+ * position, in the order of the commands. Other members would do nothing.
+ */
+static void
+run_substs(struct op *op) {
+  unsigned long *row, *replacing, *first, w;
+  int words, i, m;
+
+  words = MEMBER_WORDS(op);
+  row = op->members + (scan_substs(op) & (op->length - 1)) * words;
+  replacing = op->members + op->length * words;
+
+  m = 0;
+  while (m < op->count) {
+    i = m / MEMBER_BITS;
+    first = op->first + *out_buffer.write_pos * words;     // output byte may be changed by a member
+    w = (row[i] | replacing[i] | first[i]) & (~0UL << (m % MEMBER_BITS));
+    if (!w) {
+      m = (i + 1) * MEMBER_BITS;
+      continue;
+    }
+#ifdef __GNUC__
+    m = i * MEMBER_BITS + __builtin_ctzl(w);
+#else
+    for (m = i * MEMBER_BITS; !(w & 1); w >>= 1) m++;
+#endif
+    subst(op + 1 + m, (int) (row[i] >> (m % MEMBER_BITS)) & 1);
+    m++;
+  }
+}
+
+/**
+ * execute the compiled byte commands for current byte.
+ * If called with NULL, the handler addresses are stored to op_labels.
+ */
+#ifdef __GNUC__
+static void **op_labels;
+#  define DISPATCH() goto *op->label
+#else
+#  define DISPATCH() goto dispatch
+#endif
+
+#define NEXT() do { op++; DISPATCH(); } while (0)
+
+static void
+run_program(struct op *op) {
+  register int i;
+  unsigned char a, b;
+  char *str;
+#ifdef __GNUC__
+  static void *labels[] = {
+      &&op_end, &&op_delete, &&op_insert, &&op_replace, &&op_subst, &&op_regex, &&op_table,
+      &&op_asc_bcd, &&op_bcd_asc, &&op_skip_low, &&op_skip_high, &&op_print, &&op_until, &&op_from,
+      &&op_substs, &&op_msubst
+  };
+
+  if (op == NULL) {
+    op_labels = labels;
+    return;
+  }
+#else
+  dispatch:
+  switch (op->code) {
+    case OP_END: goto op_end;
+    case OP_DELETE: goto op_delete;
+    case OP_INSERT: goto op_insert;
+    case OP_REPLACE: goto op_replace;
+    case OP_SUBST: goto op_subst;
+    case OP_REGEX: goto op_regex;
+    case OP_TABLE: goto op_table;
+    case OP_ASC_BCD: goto op_asc_bcd;
+    case OP_BCD_ASC: goto op_bcd_asc;
+    case OP_SKIP_LOW: goto op_skip_low;
+    case OP_SKIP_HIGH: goto op_skip_high;
+    case OP_PRINT: goto op_print;
+    case OP_UNTIL: goto op_until;
+    case OP_FROM: goto op_from;
+    case OP_SUBSTS: goto op_substs;
+    case OP_MSUBST: goto op_msubst;
+  }
+#endif
+
+  DISPATCH();
+
+  op_delete:
+  if (op->rpos || op->offset == in_buffer.block_offset) {
+    if (op->rpos < op->count || op->count == 0) {
+      if (inserting) {
+        inserting = 0;
+      } else {
+        delete_this_byte = 1;
+      }
+      op->rpos++;
+    } else {
+      op->rpos = 0;
+    }
+  }
+  NEXT();
+
+  op_insert:
+  if (op->offset == in_buffer.block_offset && !op->rpos) {
+    op->rpos = 1;
+    inserting = 1;
+    NEXT();
+  }
+  if (op->rpos > 0 && op->rpos <= op->length) {
+    put_byte(op->string[op->rpos - 1]);
+    if (delete_this_byte) {
+      delete_this_byte = 0;
+    } else {
+      if (op->rpos < op->length) inserting = 1;
+    }
+    op->rpos++;
+  }
+  NEXT();
+
+  op_replace:
+  if (in_buffer.block_offset >= op->offset &&
+      in_buffer.block_offset < op->offset + op->length) {
+    put_byte(op->string[in_buffer.block_offset - op->offset]);
+  }
+  NEXT();
+
+  op_subst:
+  subst(op, 0);
+  NEXT();
+
+  op_msubst:
+  masked_subst(op);
+  NEXT();
+
+  op_regex:
+  regex_subst(op);
+  NEXT();
+
+  op_table:
+  put_byte(op->table[*out_buffer.write_pos]);
+  NEXT();
+
+  op_asc_bcd:
+  if (op->rpos || (last_byte() && out_buffer.block_offset == 0))     // skip first nibble
+  {
+    op->rpos = 0;
+    if (last_byte())  // unless last byte of block
+    {
+      if (*out_buffer.write_pos >= '0' && *out_buffer.write_pos <= '9') {
+        a = *out_buffer.write_pos - '0';
+        a = (a << 4) & 0xf0;
+        b = 0x0f;
+        *out_buffer.write_pos = a | b;
+      }
+    }
+    NEXT();
+  }
+  if (out_buffer.block_offset == 0 || delete_this_byte) NEXT();
+  if ((out_buffer.write_pos[-1] >= '0' && out_buffer.write_pos[-1] <= '9')) {
+    a = out_buffer.write_pos[-1] - '0';
+    a = (a << 4) & 0xf0;
+    if (*out_buffer.write_pos >= '0' && *out_buffer.write_pos <= '9') {
+      b = *out_buffer.write_pos - '0';
+      b &= 0x0f;
+      delete_this_byte = 1;
+      op->rpos = 1;
+    } else {
+      b = 0x0f;
+      if (*out_buffer.write_pos == 'F' || *out_buffer.write_pos == 'f') delete_this_byte = 1;
+    }
+    out_buffer.write_pos[-1] = a | b;
+  }
+  NEXT();
+
+  op_bcd_asc:
+  if (((*out_buffer.write_pos >> 4) & 0x0f) <= 9 &&
+      ((*out_buffer.write_pos & 0x0f) <= 9 || (*out_buffer.write_pos & 0x0f) == 0x0f)) {
+    a = (*out_buffer.write_pos >> 4) & 0x0f;
+    b = *out_buffer.write_pos & 0x0f;
+    *out_buffer.write_pos = '0' + a;
+    if (!delete_this_byte) {
+      write_next_byte();
+      if (b == 0x0f) {
+        *out_buffer.write_pos = 'F';
+      } else {
+        *out_buffer.write_pos = '0' + b;
+      }
+    }
+  }
+  NEXT();
+
+  op_skip_low:
+  if (in_buffer.block_offset < op->count) return;     // skip rest of commands
+  NEXT();
+
+  op_skip_high:
+  if (in_buffer.block_offset >= op->count) return;    // skip rest of commands
+  NEXT();
+
+  op_print:
+  if (delete_this_byte) NEXT();
+  i = 0;
+  a = *out_buffer.write_pos;
+  while (i < op->length) {
+    str = byte_to_string(a, op->string[i]);
+    write_string(str);
+    i++;
+    if (i < op->length) {
+      put_byte('-');
+      write_next_byte();
+    }
+  }
+  put_byte(' ');
+  NEXT();
+
+  op_until:
+  if (in_buffer.block_offset <= op->offset) put_byte(op->byte);
+  NEXT();
+
+  op_from:
+  if (in_buffer.block_offset >= op->offset) put_byte(op->byte);
+  NEXT();
+
+  op_substs:
+  if (op->rpos || (!delete_this_byte && op->table[*out_buffer.write_pos])) run_substs(op);
+  op += op->count;                                // members are run by run_substs
+  NEXT();
+
+  op_end:
+  return;
+}
+
+/**
+ * find the next block offset from offset on where some command of a scheduled program
+ * starts, stops or changes its state. Between the events every command does the same
+ * to every byte.
+ * @return the offset of the next event or -1 if there is none
+ */
+static off_t
+next_event(off_t offset) {
+  struct op *op;
+  off_t next, at;
+
+  next = -1;
+  for (op = program; op->code != OP_END; op++) {
+    at = -1;
+    switch (op->code) {
+      case OP_DELETE:
+        if (op->rpos) {
+          if (op->count) at = offset + op->count - op->rpos;
+        } else if (op->offset >= offset) {
+          at = op->offset;
+        }
+        break;
+      case OP_INSERT:
+        if (!op->rpos) {
+          if (op->offset >= offset) at = op->offset;
+        } else if (op->rpos <= op->length) {
+          at = offset;
+        }
+        break;
+      case OP_REPLACE:
+        if (op->offset > offset) {
+          at = op->offset;
+        } else if (op->offset + op->length > offset) {
+          at = op->offset + op->length;
+        }
+        break;
+      case OP_UNTIL:
+        if (op->offset >= offset) at = op->offset + 1;
+        break;
+      case OP_FROM:
+        if (op->offset > offset) at = op->offset;
+        break;
+      case OP_SKIP_LOW:
+      case OP_SKIP_HIGH:
+        if (op->count > offset) at = op->count;
+        break;
+    }
+    if (at >= 0 && (next < 0 || at < next)) next = at;
+  }
+  return next;
+}
+
+/**
+ * apply the commands of a scheduled program to length bytes already in the output buffer,
+ * the first byte is at block offset offset
+ */
+static void
+apply_span(unsigned char *p, off_t offset, off_t length) {
+  struct op *op;
+
+  for (op = program; op->code != OP_END; op++) {
+    switch (op->code) {
+      case OP_TABLE:
+        translate(op->table, p, p, (size_t) length);
+        break;
+      case OP_REPLACE:
+        if (offset >= op->offset && offset < op->offset + op->length)
+          memcpy(p, op->string + (offset - op->offset), length);
+        break;
+      case OP_UNTIL:
+        if (offset <= op->offset) memset(p, op->byte, length);
+        break;
+      case OP_FROM:
+        if (offset >= op->offset) memset(p, op->byte, length);
+        break;
+      case OP_SKIP_LOW:
+        if (offset < op->count) return;
+        break;
+      case OP_SKIP_HIGH:
+        if (offset >= op->count) return;
+        break;
+    }
+  }
+}
+
+/**
+ * execute a scheduled program for length bytes starting from the read position, no event
+ * may fall on these bytes
+ */
+static void
+run_span(off_t length) {
+  struct op *op;
+  unsigned char *from;
+  off_t offset, room;
+  int deleted, modified;
+
+  offset = in_buffer.block_offset;
+  deleted = delete_this_block;
+  modified = 0;
+
+  for (op = program; op->code != OP_END; op++) {
+    if (op->code == OP_SKIP_LOW && offset < op->count) break;
+    if (op->code == OP_SKIP_HIGH && offset >= op->count) break;
+    if (op->code == OP_DELETE && op->rpos) {
+      deleted = 1;
+      op->rpos += length;
+    }
+    if (op->code == OP_TABLE ||
+        (op->code == OP_REPLACE && offset >= op->offset && offset < op->offset + op->length) ||
+        (op->code == OP_UNTIL && offset <= op->offset) ||
+        (op->code == OP_FROM && offset >= op->offset))
+      modified = 1;
+  }
+
+  if (deleted) return;
+
+  from = in_buffer.read_pos;
+  if (!modified) {
+    write_input_span(from, length);
+    return;
+  }
+
+  while (length > 0) {
+    room = out_buffer.end - out_buffer.write_pos;
+    if (room > length) room = length;
+    memcpy(out_buffer.write_pos, from, room);
+    apply_span(out_buffer.write_pos, offset, room);
+    out_buffer.write_pos += room;
+    out_buffer.block_offset += room;
+    from += room;
+    offset += room;
+    length -= room;
+    if (out_buffer.write_pos >= out_buffer.end) flush_buffer();
+  }
+}
+
+/**
+ * process the rest of the block with a scheduled program. Bytes between the events are
+ * processed in bulk, the bytes at the events byte by byte.
+ */
+static void
+run_scheduled_block() {
+  unsigned char *last;
+  off_t length, next;
+
+  do {
+    next = next_event(in_buffer.block_offset);
+    last = in_buffer.read_pos;
+    if (next != in_buffer.block_offset) {
+      last = span_end();
+      length = (off_t) (last - in_buffer.read_pos) + 1;
+      if (next >= 0 && next - in_buffer.block_offset < length) {
+        length = next - in_buffer.block_offset;
+        last = in_buffer.read_pos + length - 1;
+      }
+      run_span(length);
+    } else {
+      do {
+        delete_this_byte = 0;
+        inserting = 0;
+        put_byte(read_byte());
+        run_program(program);
+        if (!delete_this_byte && !delete_this_block) write_next_byte();
+      } while (inserting);
+    }
+  } while (next_span(last));
+}
+
+/**
+ * compose the translation of y,&,|,^,~ or x command after table
+ */
+static void
+compose_table(unsigned char *table, struct command_list *c) {
+  int i, j;
+
+  for (i = 0; i < 256; i++) {
+    switch (c->letter) {
+      case 'y':
+        j = 0;
+        while (j < c->s1.length && c->s1.string[j] != table[i]) j++;
+        if (j < c->s1.length) table[i] = c->s2.string[j];
+        break;
+      case '&':
+        table[i] &= c->s1.string[0];
+        break;
+      case '|':
+        table[i] |= c->s1.string[0];
+        break;
+      case '^':
+        table[i] ^= c->s1.string[0];
+        break;
+      case '~':
+        table[i] = ~table[i];
+        break;
+      case 'x':
+        table[i] = ((table[i] << 4) & 0xf0) | ((table[i] >> 4) & 0x0f);
+        break;
+    }
+  }
+}
+
+/**
+ * allocate the member sets of OP_SUBSTS op for the calling thread
+ */
+static void
+alloc_members(struct op *op) {
+  size_t size;
+
+  size = (size_t) (op->length + 1) * MEMBER_WORDS(op) * sizeof(unsigned long);
+  op->members = xmalloc(size);
+  memset(op->members, 0, size);
+  op->scan = 0;
+  op->state = 0;
+}
+
+/**
+ * put a OP_SUBSTS op before each run of at least two s commands, or before a single s
+ * command with a long search string, which would otherwise be compared again at every byte.
+ * Commands with a masked search string are not grouped.
+ * The search strings of the members are found with one automaton, and only the members which
+ * are replacing or may match are run at each byte. Members have their distance to the OP_SUBSTS op in count.
+ * OP_SUBSTS op has the number of members in count, the number of replacing members in rpos,
+ * the window of input offsets kept in its member sets, a power of two, in length, and the
+ * first bytes of the search strings in table. The group is not run at other output bytes.
+ * @return the new number of ops in program
+ */
+static int
+group_substs(int n) {
+  struct op *grouped, *head;
+  struct pattern *tails;
+  struct automaton *a;
+  int i, j, k, m, words;
+
+  grouped = xmalloc((size_t) (2 * n + 1) * sizeof(struct op));
+  tails = xmalloc((size_t) (n + 1) * sizeof(struct pattern));
+  m = 0;
+  i = 0;
+  while (i < n) {
+    for (j = i; j < n && program[j].code == OP_SUBST && program[j].length; j++);
+
+    a = NULL;
+    if (j - i >= 2 || (j - i == 1 && program[i].length >= SUBST_LONG)) {
+      for (k = i; k < j; k++) {
+        tails[k - i].string = program[k].string + 1;    // first byte is compared to the output
+        tails[k - i].length = program[k].length - 1;
+      }
+      a = xmalloc(sizeof(struct automaton));
+      if (!init_automaton(a, tails, j - i)) {
+        free(a);
+        a = NULL;
+      }
+    }
+
+    if (a == NULL) {
+      if (j == i) j = i + 1;
+      while (i < j) grouped[m++] = program[i++];
+      continue;
+    }
+
+    head = &grouped[m++];
+    memset(head, 0, sizeof(struct op));
+    head->code = OP_SUBSTS;
+    head->count = j - i;
+    head->automaton = a;
+    for (head->length = SUBSTS_WINDOW; head->length <= 2 * a->longest; head->length *= 2);
+    words = MEMBER_WORDS(head);
+    head->first = xmalloc(256 * words * sizeof(unsigned long));
+    memset(head->first, 0, 256 * words * sizeof(unsigned long));
+    head->table = xmalloc(256);
+    memset(head->table, 0, 256);
+    alloc_members(head);
+
+    for (k = 0; i < j; i++, k++) {
+      head->table[program[i].string[0]] = 1;
+      if (program[i].length == 1)
+        head->first[program[i].string[0] * words + k / MEMBER_BITS] |= 1UL << (k % MEMBER_BITS);
+      grouped[m] = program[i];
+      grouped[m].count = k + 1;
+      m++;
+    }
+  }
+  grouped[m].code = OP_END;
+
+  free(tails);
+  free(program);
+  program = compiled_program = grouped;
+  return m;
+}
+
+/**
+ * compile the byte commands to a flat array of ops.
+ * Commands which cannot change the output are left out.
+ */
+void
+compile_commands(struct commands *commands) {
+  struct command_list *c;
+  struct op *op;
+  int n, i;
+
+  n = 0;
+  for (c = commands->byte; c != NULL; c = c->next) n++;
+  program = compiled_program = xmalloc((n + 1) * sizeof(struct op));
+  op = program;
+
+#ifdef __GNUC__
+  run_program(NULL);
+#endif
+
+  for (c = commands->byte; c != NULL; c = c->next) {
+    memset(op, 0, sizeof(struct op));
+
+    switch (c->letter) {
+      case 'd':
+        op->code = OP_DELETE;
+        op->offset = c->offset;
+        op->count = c->count;
+        break;
+      case 'i':
+      case 'r':
+        op->code = c->letter == 'i' ? OP_INSERT : OP_REPLACE;
+        op->offset = c->offset;
+        op->string = c->s1.string;
+        op->length = c->s1.length;
+        break;
+      case 'y':
+      case '&':
+      case '|':
+      case '^':
+      case '~':
+      case 'x':
+        if (op > program && op[-1].code == OP_TABLE) {     // fuse to previous
+          compose_table(op[-1].table, c);
+          continue;
+        }
+        op->code = OP_TABLE;
+        op->table = xmalloc(256);
+        for (i = 0; i < 256; i++) op->table[i] = (unsigned char) i;
+        compose_table(op->table, c);
+        break;
+      case 's':
+        op->code = c->s1.mask != NULL ? OP_MSUBST : OP_SUBST;
+        op->string = c->s1.string;
+        op->length = c->s1.length;
+        op->mask = c->s1.mask;
+        op->string2 = c->s2.string;
+        op->length2 = c->s2.length;
+        break;
+      case 't':
+        op->code = OP_REGEX;
+        op->regex = c->regex;
+        op->string2 = xmalloc((size_t) c->regex->expansion_max + 1);
+        break;
+      case 'c':
+        op->code = c->s1.string[0] == 'A' ? OP_ASC_BCD : OP_BCD_ASC;
+        break;
+      case 'j':
+      case 'l':
+        if (c->letter == 'j' && c->count <= 0) continue;   // never skips
+        op->code = c->letter == 'j' ? OP_SKIP_LOW : OP_SKIP_HIGH;
+        op->count = c->count;
+        break;
+      case 'p':
+        op->code = OP_PRINT;
+        op->string = c->s1.string;
+        op->length = c->s1.length;
+        break;
+      case 'u':
+      case 'f':
+        op->code = c->letter == 'u' ? OP_UNTIL : OP_FROM;
+        op->offset = c->offset;
+        op->byte = c->s1.string[0];
+        break;
+      default:                               // w is handled in write_w_command
+        continue;
+    }
+    op++;
+    if (c->letter == 'l' && c->count <= 0) break;   // rest of commands are never executed
+  }
+  op->code = OP_END;
+
+  for (op = program, n = 0; op->code != OP_END; op++) {    // remove translations which change nothing
+    if (op->code == OP_TABLE) {
+      for (i = 0; i < 256 && op->table[i] == i; i++);
+      if (i == 256) {
+        free(op->table);
+        continue;
+      }
+    }
+    program[n++] = *op;
+  }
+  program[n].code = OP_END;
+
+  table_program = program[0].code == OP_TABLE && program[1].code == OP_END;
+  deleted_block_output = 0;
+  scheduled_program = 1;
+  for (i = 0; i < n; i++) {
+    switch (program[i].code) {
+      case OP_PRINT:
+      case OP_ASC_BCD:
+      case OP_BCD_ASC:
+        deleted_block_output = 1;
+        scheduled_program = 0;
+        break;
+      case OP_SUBST:
+      case OP_MSUBST:
+      case OP_REGEX:
+        scheduled_program = 0;
+        break;
+    }
+  }
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512vbmi") && __builtin_cpu_supports("avx512bw")) translate = translate_vbmi;
+#endif
+
+  n = group_substs(n);
+
+#ifdef __GNUC__
+  for (i = 0; i <= n; i++) program[i].label = op_labels[program[i].code];
+#endif
+}
+
+/**
+ * give the calling worker thread its own copy of the compiled program
+ */
+void
+init_worker_program() {
+  int n;
+
+  for (n = 0; compiled_program[n].code != OP_END; n++);
+  program = xmalloc((n + 1) * sizeof(struct op));
+  memcpy(program, compiled_program, (n + 1) * sizeof(struct op));
+
+  for (n = 0; program[n].code != OP_END; n++) {
+    if (program[n].code == OP_SUBSTS) alloc_members(&program[n]);
+    if (program[n].code == OP_REGEX) {
+      program[n].string2 = xmalloc((size_t) program[n].regex->expansion_max + 1);
+      program[n].scan = 0;
+    }
+  }
+}
+
+/**
+ * write w command, will be called when output_buffer is written, same will be written to w-command files
+ */
+void
+write_w_command(unsigned char *buf, size_t length) {
+  struct command_list *c;
+
+  if (skip_this_block) return;
+
+  c = current_byte_commands;
+
+  while (c != NULL) {
+    if (c->letter == 'w') {
+      if (fwrite(buf, 1, length, c->fd) != length) panic("Cannot write to file", c->s2.string, strerror(errno));
+      if (length) c->count = 1;    // file was written
+    }
+    c = c->next;
+  }
+}
+
+/**
+ * finds the %B or %nB format string from the filename of w-command
+ * @return pointer to %-position and the length of the format string
+ */
+char *
+find_block_w_file(char *file, int *len) {
+  char *f, *ppos;
+
+  f = file;
+
+  while (*f != 0) {
+    if (*f == '%') {
+      ppos = f;
+      f++;
+      while (f - ppos < 4 && isdigit(*f)) f++;
+      if (*f == 'B') {
+        *len = (int) (f - ppos) + 1;
+        return ppos;
+      }
+      f = ppos;
+    }
+    f++;
+  }
+  return NULL;
+}
+
+/**
+ * replaces all %B or %nB format strings with block number in a file name
+ */
+void
+bn_printf(char *file, char *str, off_t block_number) {
+  char *bstart, *f;
+  char num[128], format[64];
+  int blen;
+
+  f = str;
+  file[0] = 0;
+
+  while ((bstart = find_block_w_file(f, &blen)) != NULL) {
+    num[0] = 0;
+    format[0] = 0;
+    strncat(file, f, bstart - f);
+    strncpy(format, bstart, blen - 1);
+    format[blen - 1] = 0;
+    strcat(format, "lld");
+    sprintf(num, format, (long long) block_number);
+    if (strlen(file) + strlen(num) >= 4096) panic("Filename for w-command too long", str, NULL);
+    strcat(file, num);
+    f = bstart + blen;
+  }
+  strcat(file, f);
+}
+
+/**
+ * close (if open) and open next w-command files for new block
+ */
+void
+open_w_files(off_t block_number) {
+  struct command_list *c;
+  static char file[4096];
+
+  c = current_byte_commands;
+
+  while (c != NULL) {
+    if (c->letter == 'w' && c->offset) {
+      if (c->fd != NULL) {
+        if (fclose(c->fd) != 0) panic("Error closing file", c->s2.string, strerror(errno));
+        if (!c->count && c->s2.string != NULL)  // remove if empty
+        {
+          unlink(c->s2.string);
+        }
+        c->fd = NULL;
+      }
+
+      bn_printf(file, c->s1.string, block_number);
+
+#ifdef WIN32
+      errno_t rc = fopen_s(&c->fd, file, "wb");
+      if (rc != 0) panic("Cannot open file for writing", file, strerror(rc));
+#else
+      c->fd = fopen(file,"w");
+      if(c->fd == NULL) panic("Cannot open file for writing",file,strerror(errno));
+#endif
+      c->count = 0;
+      if (c->s2.string != NULL) free(c->s2.string);
+      c->s2.string = xstrdup(file);
+    }
+    c = c->next;
+  }
+}
+
+
+#define IO_BLOCK_SIZE (8 * 1024)
+
+/**
+ * read the contents of the file of < or > command to s2, file is read only once
+ * and the contents are written for each block
+ */
+static void
+read_insert_file(struct command_list *c) {
+  FILE *fp;
+  size_t read_count;
+  off_t size = IO_BLOCK_SIZE;
+
+#ifdef WIN32
+  errno_t rc = fopen_s(&fp, c->s1.string, "rb");
+  if (rc != 0) panic("Cannot open for reading", c->s1.string, strerror(rc));
+#else
+  fp = fopen(c->s1.string, "r");
+  if (fp == NULL) panic("Cannot open file for reading", c->s1.string, strerror(errno));
+#endif
+
+  c->s2.string = xmalloc(size);
+  c->s2.length = 0;
+  while ((read_count = fread(c->s2.string + c->s2.length, 1, (size_t) (size - c->s2.length), fp)) > 0) {
+    c->s2.length += (off_t) read_count;
+    if (c->s2.length == size) {
+      size *= 2;
+      c->s2.string = xrealloc(c->s2.string, size);
+    }
+  }
+  if (ferror(fp)) panic("Error reading file", c->s1.string, strerror(errno));
+  fclose(fp);
+  c->fd = NULL;
+}
+
+/**
+ * check if the commands write every input byte to the same offset in output, needed for -i
+ * @return true if the length of the data is not changed
+ */
+int
+length_preserving(struct commands *commands) {
+  struct command_list *c;
+
+  if (output_only_block || commands->block_end != NULL) return 0;
+
+  for (c = commands->block_start; c != NULL; c = c->next) {
+    if (c->letter != 'J' && c->letter != 'L') return 0;    // K and D delete blocks
+  }
+
+  for (c = commands->byte; c != NULL; c = c->next) {
+    switch (c->letter) {
+      case 's':
+        if (c->s1.length != c->s2.length) return 0;
+        break;
+      case 'r':
+      case 'y':
+      case '&':
+      case '|':
+      case '^':
+      case '~':
+      case 'x':
+      case 'u':
+      case 'f':
+      case 'j':
+      case 'l':
+      case 'w':
+        break;
+      default:
+        return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * @return length of the longest string the byte commands compare to the input ahead
+ * of the read position, the input buffer must keep this many bytes after the low water mark
+ */
+off_t
+longest_search(struct commands *commands) {
+  struct command_list *c;
+  off_t longest = 0;
+
+  for (c = commands->byte; c != NULL; c = c->next) {
+    if (c->letter == 's' && c->s1.length > longest) longest = c->s1.length;
+    if (c->letter == 't' && REGEX_MATCH_MAX > longest) longest = REGEX_MATCH_MAX;
+  }
+  return longest;
+}
+
+/**
+ * init_commands, initialize those which need it, currently w - open file and rpos=0 for all
+ */
+void
+init_commands(struct commands *commands) {
+  struct command_list *c;
+  int wlen;
+
+  c = commands->byte;
+
+  while (c != NULL) {
+    switch (c->letter) {
+      case 'w':
+        w_commands = 1;
+        if (find_block_w_file(c->s1.string, &wlen) != NULL) {
+          c->fd = NULL;
+          c->offset = 1;
+          w_commands_block_num = 1;
+          c->s2.string = NULL;
+        } else {
+#ifdef WIN32
+          errno_t rc = fopen_s(&c->fd, c->s1.string, "wb");
+          if (rc != 0) panic("Cannot open file for writing", c->s1.string, strerror(rc));
+#else
+          c->fd = fopen(c->s1.string,"w");
+          if(c->fd == NULL) panic("Cannot open file for writing",c->s1.string,strerror(errno));
+#endif
+          c->offset = 0;
+          c->s2.string = xstrdup(c->s1.string);
+        }
+        c->count = 0;
+        break;
+    }
+    c = c->next;
+  }
+
+  c = commands->block_start;
+
+  while (c != NULL) {
+    switch (c->letter) {
+      case '>':
+        read_insert_file(c);
+        break;
+    }
+    c = c->next;
+  }
+
+  c = commands->block_end;
+
+  while (c != NULL) {
+    switch (c->letter) {
+      case '<':
+        read_insert_file(c);
+        break;
+    }
+    c = c->next;
+  }
+
+}
+
+
+/**
+ * close_commands, close those wich need it, currently w - close file
+ */
+void
+close_commands(struct commands *commands) {
+  struct command_list *c;
+
+  c = commands->byte;
+
+  while (c != NULL) {
+    switch (c->letter) {
+      case 'w':
+        if (c->fd != NULL) {
+          if (fclose(c->fd) != 0) panic("Error in closing file", c->s2.string, strerror(errno));
+          if (!c->count && c->s2.string != NULL) {
+            unlink(c->s2.string);
+          }
+        }
+        break;
+    }
+    c = c->next;
+  }
+
+  c = commands->block_start;
+
+  while (c != NULL) {
+    switch (c->letter) {
+      case '>':
+        free(c->s2.string);
+        break;
+    }
+    c = c->next;
+  }
+
+  c = commands->block_end;
+
+  while (c != NULL) {
+    switch (c->letter) {
+      case '<':
+        free(c->s2.string);
+        break;
+    }
+    c = c->next;
+  }
+}
+
+/**
+ * find the block after which the remaining input can't change the output. Bytes between blocks
+ * must not be written, which is the case with -s and -i. Commands D, K, J and L act alike on
+ * all blocks numbered above their arguments, so it is enough to check one such block.
+ * @return the block number, -1 if all blocks may change the output
+ */
+static off_t
+find_last_live_block(struct commands *commands) {
+  struct command_list *c;
+  off_t last = 0;
+  int delete, in_place;
+
+  in_place = in_place_output();
+  if (!output_only_block && !in_place) return -1;
+  if (block.type & BLOCK_START_M) return 1;          // only one block
+  if (w_commands) return -1;                         // w commands write every block
+
+  for (c = commands->block_start; c != NULL; c = c->next) {
+    if ((c->letter == 'D' || c->letter == 'K') && c->offset > last) last = c->offset;
+    if ((c->letter == 'J' || c->letter == 'L') && c->count > last) last = c->count;
+  }
+
+  delete = commands->block_start != NULL && commands->block_start->letter == 'K';
+  for (c = commands->block_start; c != NULL; c = c->next) {
+    switch (c->letter) {
+      case 'D':
+        if (c->offset == 0) delete = 1;
+        break;
+      case 'K':
+        if (c->offset == 0) delete = 0;
+        break;
+      case 'J':
+        break;
+      case 'L':                                      // block is copied as is
+        return delete || in_place ? last : -1;
+      default:                                       // writes to output
+        return -1;
+    }
+  }
+
+  if (compiled_program[0].code != OP_END && !(delete && !deleted_block_output)) return -1;
+  if (!delete && !in_place) return -1;
+
+  for (c = commands->block_end; c != NULL; c = c->next) {
+    if (c->letter == 'L') return last;
+    if (c->letter != 'D' && c->letter != 'K' && c->letter != 'J') return -1;
+  }
+  return last;
+}
+
+/**
+ * reset the rpos counter for next block, in case block was shorter eg. delete count
+ */
+static inline void
+reset_rpos(struct op *op) {
+  while (op->code != OP_END) {
+    if (op->code == OP_SUBSTS && op->rpos)
+      memset(op->members + op->length * MEMBER_WORDS(op), 0, MEMBER_WORDS(op) * sizeof(unsigned long));
+    op->rpos = 0;
+    op->fpos = -1;
+    op++;
+  }
+}
+
+
+/**
+ * main execution loop, worker threads run it for their part of the input
+ */
+void
+execute_blocks(struct commands *commands) {
+  unsigned char *last;
+
+  while ((last_live_block < 0 || in_buffer.block_num < last_live_block) && find_block()) {
+    reset_rpos(program);
+    delete_this_block = 0;
+    if (commands->block_start != NULL && commands->block_start->letter == 'K') {
+      delete_this_block = 1;
+    }
+    out_buffer.block_offset = 0;
+    skip_this_block = 0;
+    if (w_commands_block_num) open_w_files(in_buffer.block_num);
+    execute_commands(commands->block_start);
+    if (skip_this_block || program[0].code == OP_END || (delete_this_block && !deleted_block_output)) {
+      copy_block(NULL);
+    } else if (table_program) {
+      copy_block(program[0].table);
+    } else if (scheduled_program) {
+      run_scheduled_block();
+    } else {
+      do {
+        last = span_end();
+        for (;;) {
+          delete_this_byte = 0;
+          inserting = 0;
+          put_byte(*in_buffer.read_pos);   // as default write current byte from input
+          run_program(program);
+          if (!delete_this_byte && !delete_this_block) {
+            write_next_byte();           // advance the write pointer if byte is not marked for del
+          }
+          if (inserting) continue;
+          if (in_buffer.read_pos == last) break;
+          in_buffer.read_pos++;
+          in_buffer.block_offset++;
+        }
+      } while (next_span(last));
+    }
+    execute_commands(commands->block_end);
+    if (w_commands) flush_buffer();
+  }
+}
+
+/**
+ * execute the commands for all blocks of the input
+ */
+void
+execute_program(struct commands *commands) {
+  current_byte_commands = commands->byte;
+  last_live_block = find_last_live_block(commands);
+
+  if (jobs < 2 || !execute_parallel(commands)) execute_blocks(commands);
+  flush_buffer();
+  close_output_stream();
+  close_input_stream();
+}
@@ -0,0 +1,402 @@
+/*
+ *    bbe - Binary block editor
+ *
+ *    Copyright (C) 2005 Timo Savinen
+ *    This file is part of bbe.
+ *
+ *    bbe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    bbe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with bbe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "bbe.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_SYS_MMAN_H)
+
+#define TASK_SCAN    1     // find block start and stop strings in a part of the input
+#define TASK_EXECUTE 2     // execute the commands for a range of whole blocks
+
+/**
+ * work for the worker threads
+ */
+struct task {
+  int kind;
+  int done;
+  off_t offset;                 // range of the input
+  off_t length;
+  off_t block_num;              // blocks before the range
+  struct sink output;           // output of TASK_EXECUTE
+  struct occurrences starts;    // strings found by TASK_SCAN
+  struct occurrences stops;
+  struct task *next;            // next task in the work queue
+  struct task *following;       // next task in the output order
+};
+
+/**
+ * position of the stitching in the occurrences of scanned parts. Stop cursor
+ * finds the block ends, also when the next block start ends the block.
+ */
+struct cursor {
+  off_t part;
+  size_t index;
+};
+
+static struct commands *part_commands;
+static int slots;                    // tasks which can be processed ahead of the output
+static int fixed_blocks;             // blocks are :M, ranges are computed, no scanning
+
+static off_t input_size;
+static off_t part_length;            // bytes in one part
+static off_t part_count;
+
+static struct task *queue_head;      // work queue
+static struct task *queue_tail;
+static int queue_closed;
+static off_t completed;              // number of completed tasks
+
+static pthread_mutex_t task_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t task_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t task_done = PTHREAD_COND_INITIALIZER;
+
+static struct task **scans;          // scan task of every part
+static off_t next_scan;
+static off_t freed_scans;
+static struct cursor start_cursor;
+static struct cursor stop_cursor;
+
+static off_t stitch_pos;             // where the next block is searched
+static off_t range_start;            // start of the range not yet given to workers
+static off_t range_blocks;           // blocks before range_start
+static off_t blocks;                 // blocks found
+static int stitched;                 // all blocks are found
+
+static struct task *output_head;     // execute tasks in output order
+static struct task *output_tail;
+static int output_tasks;
+
+/**
+ * check if the input and commands can be split to ranges processed independently.
+ * Input must be a mapped file with blocks starting with a string or immediately after
+ * the previous block and ending with a string or length, and there must be no w commands,
+ * which write files in order.
+ * @return true if the input can be processed in parallel
+ */
+static int
+parallel_input(struct commands *commands) {
+  struct command_list *c;
+
+  input_size = mapped_input_size();
+  if (!input_size) return 0;
+  if (!(block.type & BLOCK_START_S) || block.type & BLOCK_STOP_R) return 0;
+  if (!block.start.S.length && block.type & BLOCK_STOP_S && !block.stop.S.length) return 0;
+
+  for (c = commands->byte; c != NULL; c = c->next) if (c->letter == 'w') return 0;
+
+  fixed_blocks = !block.start.S.length && block.type & BLOCK_STOP_M;
+  part_length = PARALLEL_PART_SIZE;
+  if (fixed_blocks) {
+    part_length = PARALLEL_PART_SIZE / block.stop.M * block.stop.M;
+    if (part_length < block.stop.M) part_length = block.stop.M;
+  }
+  part_count = (input_size + part_length - 1) / part_length;
+  return part_count > 1;
+}
+
+/**
+ * put a task to the work queue
+ */
+static struct task *
+queue_task(int kind, off_t offset, off_t length, off_t block_num) {
+  struct task *t;
+
+  t = xmalloc(sizeof(struct task));
+  memset(t, 0, sizeof(struct task));
+  t->kind = kind;
+  t->offset = offset;
+  t->length = length;
+  t->block_num = block_num;
+
+  pthread_mutex_lock(&task_lock);
+  if (queue_tail == NULL) {
+    queue_head = t;
+  } else {
+    queue_tail->next = t;
+  }
+  queue_tail = t;
+  pthread_cond_signal(&task_queued);
+  pthread_mutex_unlock(&task_lock);
+  return t;
+}
+
+/**
+ * @return true if task is completed
+ */
+static int
+task_completed(struct task *t) {
+  int done;
+
+  pthread_mutex_lock(&task_lock);
+  done = t->done;
+  pthread_mutex_unlock(&task_lock);
+  return done;
+}
+
+/**
+ * worker thread, takes tasks from the work queue until it is closed
+ */
+static void *
+worker(void *arg) {
+  struct task *t;
+
+  (void) arg;
+  init_output_buffer();
+  init_worker_program();
+
+  for (;;) {
+    pthread_mutex_lock(&task_lock);
+    while (queue_head == NULL && !queue_closed) pthread_cond_wait(&task_queued, &task_lock);
+    t = queue_head;
+    if (t != NULL) {
+      queue_head = t->next;
+      if (queue_head == NULL) queue_tail = NULL;
+      t->next = NULL;
+    }
+    pthread_mutex_unlock(&task_lock);
+    if (t == NULL) break;
+
+    if (t->kind == TASK_SCAN) {
+      scan_input_part(t->offset, t->length, &t->starts, &t->stops);
+    } else {
+      set_output_sink(&t->output);
+      map_input_part(t->offset, t->length, t->block_num);
+      execute_blocks(part_commands);
+      flush_buffer();
+      unmap_input_part();
+    }
+
+    pthread_mutex_lock(&task_lock);
+    t->done = 1;
+    completed++;
+    pthread_cond_broadcast(&task_done);
+    pthread_mutex_unlock(&task_lock);
+  }
+  return NULL;
+}
+
+/**
+ * give the range from range_start to end - 1 to the workers for execution
+ */
+static void
+execute_range(off_t end) {
+  struct task *t;
+
+  t = queue_task(TASK_EXECUTE, range_start, end - range_start, range_blocks);
+  if (output_tail == NULL) {
+    output_head = t;
+  } else {
+    output_tail->following = t;
+  }
+  output_tail = t;
+  output_tasks++;
+  range_start = end;
+  range_blocks = blocks;
+}
+
+/**
+ * find the first string occurrence at or after position from the scanned parts
+ * @return 1 if found, 0 if there is none and -1 if the part is not yet scanned
+ */
+static int
+next_occurrence(struct cursor *c, int stop, off_t position, off_t *found) {
+  struct task *t;
+  struct occurrences *o;
+
+  while (c->part < part_count) {
+    t = scans[c->part];
+    if (t == NULL || !task_completed(t)) return -1;
+    o = stop ? &t->stops : &t->starts;
+    while (c->index < o->count && t->offset + (off_t) o->offset[c->index] < position) c->index++;
+    if (c->index < o->count) {
+      *found = t->offset + (off_t) o->offset[c->index];
+      return 1;
+    }
+    c->part++;
+    c->index = 0;
+  }
+  return 0;
+}
+
+/**
+ * find the blocks as find_block would, using the strings found by the scan tasks, and
+ * split the input to ranges of whole blocks
+ * @return true if some progress was made
+ */
+static int
+stitch_blocks() {
+  off_t start, end, found;
+  int progress = 0, r;
+
+  while (!stitched && output_tasks < slots) {
+    if (fixed_blocks) {
+      end = range_start + part_length;
+      if (end > input_size) end = input_size;
+      blocks += part_length / block.stop.M;
+      stitch_pos = end;
+    } else {
+      if (!block.start.S.length) {
+        start = stitch_pos;
+        r = start < input_size;
+      } else {
+        r = next_occurrence(&start_cursor, 0, stitch_pos, &start);
+      }
+      if (r < 0) break;
+      if (r == 0) {
+        stitch_pos = input_size;
+      } else {
+        if (block.type & BLOCK_STOP_M) {
+          r = 1;
+          end = start + block.stop.M - 1;
+          if (end > input_size - 1) end = input_size - 1;
+        } else if (block.stop.S.length) {
+          r = next_occurrence(&stop_cursor, 1, start + block.start.S.length, &found);
+          end = r > 0 ? found + block.stop.S.length - 1 : input_size - 1;
+        } else {
+          r = next_occurrence(&stop_cursor, 0, start + block.start.S.length, &found);
+          end = r > 0 ? found - 1 : input_size - 1;
+        }
+        if (r < 0) break;
+        blocks++;
+        stitch_pos = end + 1;
+      }
+    }
+    progress = 1;
+    if (stitch_pos >= input_size) stitched = 1;
+    if (last_live_block >= 0 && blocks >= last_live_block) stitched = 1;    // rest is not needed
+    if (stitch_pos > range_start && (stitch_pos - range_start >= part_length || stitched))
+      execute_range(stitch_pos);
+  }
+  return progress;
+}
+
+/**
+ * queue scan tasks ahead of stitching and free the scanned parts already stitched
+ */
+static void
+scan_ahead() {
+  off_t first, last;
+
+  first = part_count;
+  last = 0;
+  if (block.start.S.length) {
+    first = last = start_cursor.part;
+  }
+  if (block.type & BLOCK_STOP_S) {
+    if (stop_cursor.part < first) first = stop_cursor.part;
+    if (stop_cursor.part > last) last = stop_cursor.part;
+  }
+
+  for (; freed_scans < first && freed_scans < next_scan; freed_scans++) {
+    free(scans[freed_scans]->starts.offset);
+    free(scans[freed_scans]->stops.offset);
+    free(scans[freed_scans]);
+  }
+
+  if (last < first + slots) last = first + slots - 1;
+  while (next_scan < part_count && next_scan <= last) {
+    scans[next_scan] = queue_task(TASK_SCAN, next_scan * part_length, part_length, (off_t) 0);
+    if (next_scan == part_count - 1) scans[next_scan]->length = input_size - next_scan * part_length;
+    next_scan++;
+  }
+}
+
+/**
+ * execute the commands with jobs worker threads, the output of the ranges is written in order
+ * @return false if input can't be processed in parallel
+ */
+int
+execute_parallel(struct commands *commands) {
+  pthread_t *threads;
+  struct task *t;
+  off_t seen;
+  int i, rc, progress;
+
+  if (!parallel_input(commands)) return 0;
+
+  part_commands = commands;
+  slots = PARALLEL_QUEUE * jobs;
+  if (!fixed_blocks) {
+    scans = xmalloc(part_count * sizeof(struct task *));
+    memset(scans, 0, part_count * sizeof(struct task *));
+  }
+
+  threads = xmalloc(jobs * sizeof(pthread_t));
+  for (i = 0; i < jobs; i++) {
+    rc = pthread_create(&threads[i], NULL, worker, NULL);
+    if (rc) panic("Cannot create thread", NULL, strerror(rc));
+  }
+
+  while (!stitched || output_head != NULL) {
+    pthread_mutex_lock(&task_lock);
+    seen = completed;
+    pthread_mutex_unlock(&task_lock);
+
+    progress = stitch_blocks();
+
+    while (output_head != NULL && task_completed(output_head)) {
+      t = output_head;
+      write_output_stream(t->output.buffer, t->output.length);
+      output_head = t->following;
+      if (output_head == NULL) output_tail = NULL;
+      output_tasks--;
+      free(t->output.buffer);
+      free(t);
+      progress = 1;
+    }
+
+    if (!fixed_blocks) scan_ahead();
+    if (!progress) {
+      pthread_mutex_lock(&task_lock);
+      while (completed == seen) pthread_cond_wait(&task_done, &task_lock);
+      pthread_mutex_unlock(&task_lock);
+    }
+  }
+
+  pthread_mutex_lock(&task_lock);
+  queue_closed = 1;
+  pthread_cond_broadcast(&task_queued);
+  pthread_mutex_unlock(&task_lock);
+  for (i = 0; i < jobs; i++) pthread_join(threads[i], NULL);
+
+  if (!fixed_blocks) {
+    for (; freed_scans < next_scan; freed_scans++) {
+      free(scans[freed_scans]->starts.offset);
+      free(scans[freed_scans]->stops.offset);
+      free(scans[freed_scans]);
+    }
+    free(scans);
+  }
+  free(threads);
+  return 1;
+}
+
+#else
+
+int
+execute_parallel(struct commands *commands) {
+  return 0;
+}
+
+#endif
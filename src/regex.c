@@ -0,0 +1,960 @@
+/*
+ *    bbe - Binary block editor
+ *
+ *    Copyright (C) 2005 Timo Savinen
+ *    This file is part of bbe.
+ *
+ *    bbe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    bbe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with bbe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "bbe.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/**
+ * instructions of the program compiled from a regular expression. The DFA is built from the
+ * program, and the program is run to find the groups of a match.
+ */
+#define RX_BYTE   1      // byte in set x
+#define RX_SPLIT  2      // continue at x and at y, x has priority
+#define RX_JMP    3      // continue at x
+#define RX_SAVE   4      // save position to group slot x
+#define RX_MATCH  5
+#define RX_BOL    6      // continue if at the start of the block
+#define RX_EOL    7      // continue if at the end of the block
+
+/**
+ * largest program compiled from a regular expression
+ */
+#define RX_PROGRAM_MAX (64*1024)
+
+/**
+ * nodes of a parsed regular expression
+ */
+#define RX_SET    1      // byte in set
+#define RX_CAT    2      // left followed by right
+#define RX_ALT    3      // left or right
+#define RX_REPEAT 4      // left repeated from min to max times, max -1 for no limit
+#define RX_GROUP  5      // left in group
+#define RX_EMPTY  6
+#define RX_ANCHOR 7      // ^ or $, instruction in set
+
+struct rx_node {
+  int type;
+  int set;
+  int group;
+  int min;
+  int max;
+  struct rx_node *left;
+  struct rx_node *right;
+};
+
+struct rx_inst {
+  int code;
+  int x;
+  int y;
+};
+
+/**
+ * state of the parser
+ */
+struct rx_parser {
+  char *expression;
+  char *p;
+  struct regex *r;
+};
+
+/**
+ * working storage for finding the groups of a match, one for each thread
+ */
+struct rx_threads {
+  int size;               // instructions and slots the storage is allocated for
+  int slots;
+  int *pc[2];             // threads of the current and the next position
+  off_t *caps[2];         // group slots of the threads
+  int count[2];
+  unsigned int *mark;     // generation in which an instruction was added
+  unsigned int generation;
+  int *stack;             // instruction, or -2 - slot to restore followed by the old value
+  off_t *old;
+  off_t *work;            // group slots of the thread being added
+  off_t *group;           // groups of the match
+};
+
+static THREAD_LOCAL struct rx_threads threads;
+
+static struct rx_node *parse_alternation(struct rx_parser *ps, int depth);
+
+static struct rx_node *
+new_node(int type, struct rx_node *left, struct rx_node *right) {
+  struct rx_node *n;
+
+  n = xmalloc(sizeof(struct rx_node));
+  memset(n, 0, sizeof(struct rx_node));
+  n->type = type;
+  n->left = left;
+  n->right = right;
+  return n;
+}
+
+static void
+free_node(struct rx_node *n) {
+  if (n == NULL) return;
+  free_node(n->left);
+  free_node(n->right);
+  free(n);
+}
+
+/**
+ * add an empty byte set to the regular expression
+ * @return index of the set
+ */
+static int
+new_set(struct regex *r) {
+  if ((r->sets & 15) == 0) r->set = xrealloc(r->set, (size_t) (r->sets + 16) * sizeof(*r->set));
+  memset(r->set[r->sets], 0, sizeof(*r->set));
+  return r->sets++;
+}
+
+static void
+add_byte(struct regex *r, int set, int byte) {
+  r->set[set][byte >> 3] |= (unsigned char) (1 << (byte & 7));
+}
+
+static int
+in_set(struct regex *r, int set, int byte) {
+  return r->set[set][byte >> 3] & (1 << (byte & 7));
+}
+
+/**
+ * node matching one byte
+ */
+static struct rx_node *
+byte_node(struct rx_parser *ps, int byte) {
+  struct rx_node *n;
+
+  n = new_node(RX_SET, NULL, NULL);
+  n->set = new_set(ps->r);
+  add_byte(ps->r, n->set, byte);
+  return n;
+}
+
+/**
+ * node matching any byte
+ */
+static struct rx_node *
+any_node(struct regex *r) {
+  struct rx_node *n;
+
+  n = new_node(RX_SET, NULL, NULL);
+  n->set = new_set(r);
+  memset(r->set[n->set], 0xff, sizeof(*r->set));
+  return n;
+}
+
+/**
+ * parse a byte of an expression, escape codes are those of strings, other characters after a
+ * backslash are taken as such
+ * @return the byte
+ */
+static int
+parse_byte(struct rx_parser *ps) {
+  int k;
+
+  if (*ps->p != '\\') return (unsigned char) *ps->p++;
+  ps->p++;
+  k = parse_escape(&ps->p, ps->expression);
+  if (k >= 0) return k;
+  if (*ps->p == 0) panic("Trailing backslash in regular expression", ps->expression, NULL);
+  return (unsigned char) *ps->p++;
+}
+
+/**
+ * add the bytes of a character class name like [:digit:] to set
+ * @return false if p does not start a character class name
+ */
+static int
+parse_class_name(struct rx_parser *ps, int set) {
+  static char *names[] = {"alnum", "alpha", "blank", "cntrl", "digit", "graph", "lower",
+                          "print", "punct", "space", "upper", "xdigit", NULL};
+  static int (*tests[])(int) = {isalnum, isalpha, isblank, iscntrl, isdigit, isgraph, islower,
+                                isprint, ispunct, isspace, isupper, isxdigit};
+  size_t length;
+  int i, b;
+
+  if (ps->p[0] != '[' || ps->p[1] != ':') return 0;
+  for (i = 0; names[i] != NULL; i++) {
+    length = strlen(names[i]);
+    if (strncmp(ps->p + 2, names[i], length) == 0 && strncmp(ps->p + 2 + length, ":]", 2) == 0) break;
+  }
+  if (names[i] == NULL) panic("Unknown character class in regular expression", ps->expression, NULL);
+  for (b = 0; b < 128; b++) {
+    if (tests[i](b)) add_byte(ps->r, set, b);
+  }
+  ps->p += length + 4;
+  return 1;
+}
+
+/**
+ * parse a bracket expression like [^a-z\x00], p is after the [
+ */
+static struct rx_node *
+parse_bracket(struct rx_parser *ps) {
+  struct rx_node *n;
+  int negate = 0, first = 1, low, high, b;
+
+  n = new_node(RX_SET, NULL, NULL);
+  n->set = new_set(ps->r);
+  if (*ps->p == '^') {
+    negate = 1;
+    ps->p++;
+  }
+  while (*ps->p != ']' || first) {
+    if (*ps->p == 0) panic("Unmatched [ in regular expression", ps->expression, NULL);
+    first = 0;
+    if (parse_class_name(ps, n->set)) continue;
+    low = parse_byte(ps);
+    high = low;
+    if (ps->p[0] == '-' && ps->p[1] != ']' && ps->p[1] != 0) {
+      ps->p++;
+      high = parse_byte(ps);
+      if (high < low) panic("Invalid range in regular expression", ps->expression, NULL);
+    }
+    for (b = low; b <= high; b++) add_byte(ps->r, n->set, b);
+  }
+  ps->p++;
+  if (negate) {
+    for (b = 0; b < 32; b++) ps->r->set[n->set][b] = (unsigned char) ~ps->r->set[n->set][b];
+  }
+  return n;
+}
+
+/**
+ * parse a number of a {n,m} repetition
+ */
+static int
+parse_count(struct rx_parser *ps) {
+  long n = 0;
+
+  if (!isdigit((unsigned char) *ps->p)) panic("Invalid repetition in regular expression", ps->expression, NULL);
+  while (isdigit((unsigned char) *ps->p)) {
+    n = n * 10 + (*ps->p++ - '0');
+    if (n > RX_PROGRAM_MAX) panic("Regular expression too big", ps->expression, NULL);
+  }
+  return (int) n;
+}
+
+/**
+ * parse an atom followed by repetitions
+ * @return NULL at the end of the sequence
+ */
+static struct rx_node *
+parse_piece(struct rx_parser *ps, int depth) {
+  struct rx_node *n = NULL;
+  int min, max;
+
+  switch (*ps->p) {
+    case 0:
+    case '|':
+      return NULL;
+    case ')':
+      if (depth) return NULL;
+      panic("Unmatched ) in regular expression", ps->expression, NULL);
+      break;
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+      panic("Nothing to repeat in regular expression", ps->expression, NULL);
+      break;
+    case '(':
+      ps->p++;
+      n = new_node(RX_GROUP, NULL, NULL);
+      n->group = ++ps->r->groups;
+      n->left = parse_alternation(ps, depth + 1);
+      if (*ps->p != ')') panic("Unmatched ( in regular expression", ps->expression, NULL);
+      ps->p++;
+      break;
+    case '[':
+      ps->p++;
+      n = parse_bracket(ps);
+      break;
+    case '.':
+      ps->p++;
+      n = any_node(ps->r);
+      break;
+    case '^':
+    case '$':
+      n = new_node(RX_ANCHOR, NULL, NULL);
+      n->set = *ps->p++ == '^' ? RX_BOL : RX_EOL;
+      break;
+    default:
+      n = byte_node(ps, parse_byte(ps));
+      break;
+  }
+
+  for (;;) {
+    switch (*ps->p) {
+      case '*':
+        min = 0;
+        max = -1;
+        break;
+      case '+':
+        min = 1;
+        max = -1;
+        break;
+      case '?':
+        min = 0;
+        max = 1;
+        break;
+      case '{':
+        ps->p++;
+        min = max = parse_count(ps);
+        if (*ps->p == ',') {
+          ps->p++;
+          max = *ps->p == '}' ? -1 : parse_count(ps);
+        }
+        if (*ps->p != '}' || (max >= 0 && max < min))
+          panic("Invalid repetition in regular expression", ps->expression, NULL);
+        break;
+      default:
+        return n;
+    }
+    ps->p++;
+    n = new_node(RX_REPEAT, n, NULL);
+    n->min = min;
+    n->max = max;
+  }
+}
+
+/**
+ * parse pieces up to | or the end of a group
+ */
+static struct rx_node *
+parse_sequence(struct rx_parser *ps, int depth) {
+  struct rx_node *n, *piece;
+
+  n = new_node(RX_EMPTY, NULL, NULL);
+  while ((piece = parse_piece(ps, depth)) != NULL) n = new_node(RX_CAT, n, piece);
+  return n;
+}
+
+static struct rx_node *
+parse_alternation(struct rx_parser *ps, int depth) {
+  struct rx_node *n;
+
+  n = parse_sequence(ps, depth);
+  while (*ps->p == '|') {
+    ps->p++;
+    n = new_node(RX_ALT, n, parse_sequence(ps, depth));
+  }
+  return n;
+}
+
+/**
+ * append an instruction to the program
+ * @return index of the instruction
+ */
+static int
+emit(struct regex *r, char *expression, int code, int x, int y) {
+  if (r->program_length == RX_PROGRAM_MAX) panic("Regular expression too big", expression, NULL);
+  if ((r->program_length & 255) == 0)
+    r->program = xrealloc(r->program, (size_t) (r->program_length + 256) * sizeof(struct rx_inst));
+  r->program[r->program_length].code = code;
+  r->program[r->program_length].x = x;
+  r->program[r->program_length].y = y;
+  return r->program_length++;
+}
+
+static void
+compile_node(struct regex *r, char *expression, struct rx_node *n) {
+  int i, j, k;
+
+  switch (n->type) {
+    case RX_SET:
+      emit(r, expression, RX_BYTE, n->set, 0);
+      break;
+    case RX_ANCHOR:
+      emit(r, expression, n->set, 0, 0);
+      break;
+    case RX_CAT:
+      compile_node(r, expression, n->left);
+      compile_node(r, expression, n->right);
+      break;
+    case RX_ALT:
+      i = emit(r, expression, RX_SPLIT, 0, 0);
+      compile_node(r, expression, n->left);
+      j = emit(r, expression, RX_JMP, 0, 0);
+      r->program[i].x = i + 1;
+      r->program[i].y = r->program_length;
+      compile_node(r, expression, n->right);
+      r->program[j].x = r->program_length;
+      break;
+    case RX_GROUP:
+      emit(r, expression, RX_SAVE, 2 * n->group, 0);
+      compile_node(r, expression, n->left);
+      emit(r, expression, RX_SAVE, 2 * n->group + 1, 0);
+      break;
+    case RX_REPEAT:
+      for (k = 0; k < n->min; k++) compile_node(r, expression, n->left);
+      if (n->max < 0) {
+        i = emit(r, expression, RX_SPLIT, 0, 0);
+        compile_node(r, expression, n->left);
+        emit(r, expression, RX_JMP, i, 0);
+        r->program[i].x = i + 1;
+        r->program[i].y = r->program_length;
+      } else {
+        for (; k < n->max; k++) {
+          i = emit(r, expression, RX_SPLIT, 0, 0);
+          compile_node(r, expression, n->left);
+          r->program[i].x = i + 1;
+          r->program[i].y = r->program_length;
+        }
+      }
+      break;
+  }
+}
+
+/**
+ * divide the bytes to classes, bytes of a class are in the same sets
+ */
+static void
+init_classes(struct regex *r) {
+  unsigned char class[256];
+  int map[512];
+  int s, b, n;
+
+  memset(r->class, 0, sizeof(r->class));
+  r->classes = 1;
+  for (s = 0; s < r->sets; s++) {
+    for (b = 0; b < 2 * r->classes; b++) map[b] = -1;
+    n = 0;
+    for (b = 0; b < 256; b++) {
+      if (map[2 * r->class[b] + !!in_set(r, s, b)] < 0) map[2 * r->class[b] + !!in_set(r, s, b)] = n++;
+      class[b] = (unsigned char) map[2 * r->class[b] + !!in_set(r, s, b)];
+    }
+    memcpy(r->class, class, sizeof(class));
+    r->classes = n;
+  }
+}
+
+/**
+ * add the byte and match instructions reached from instruction pc without consuming a byte
+ * to list, instructions already marked with generation are not added again. Anchors hold
+ * if they are in anchors, $ not holding is added to list, ^ not holding ends the thread.
+ * @return new length of list
+ */
+static int
+closure(struct regex *r, int pc, int *list, int n, unsigned int *mark, unsigned int generation, int *stack,
+        int anchors) {
+  int sp = 0;
+
+  stack[sp++] = pc;
+  while (sp) {
+    pc = stack[--sp];
+    if (mark[pc] == generation) continue;
+    mark[pc] = generation;
+    switch (r->program[pc].code) {
+      case RX_JMP:
+        stack[sp++] = r->program[pc].x;
+        break;
+      case RX_SPLIT:
+        stack[sp++] = r->program[pc].y;
+        stack[sp++] = r->program[pc].x;
+        break;
+      case RX_SAVE:
+        stack[sp++] = pc + 1;
+        break;
+      case RX_BOL:
+        if (anchors & REGEX_BOL) stack[sp++] = pc + 1;
+        break;
+      case RX_EOL:
+        if (anchors & REGEX_EOL) {
+          stack[sp++] = pc + 1;
+        } else {
+          list[n++] = pc;
+        }
+        break;
+      default:
+        list[n++] = pc;
+        break;
+    }
+  }
+  return n;
+}
+
+static int
+compare_int(const void *a, const void *b) {
+  return *(const int *) a - *(const int *) b;
+}
+
+/**
+ * sets of instructions of the DFA states, while the DFA is built
+ */
+struct rx_states {
+  int *pool;              // instructions of state s are pool[start[s]] .. pool[start[s] + length[s] - 1]
+  int pool_length;
+  int pool_size;
+  int *start;
+  int *length;
+  int count;
+  int size;
+  int *table;             // hash table of the states
+  int table_size;
+};
+
+static unsigned int
+hash_list(int *list, int n) {
+  unsigned int hash = 0;
+  int i;
+
+  for (i = 0; i < n; i++) hash = hash * 31 + (unsigned int) list[i];
+  return hash;
+}
+
+/**
+ * find the DFA state of a set of instructions, list is sorted
+ * @return number of the state, a new state is added if the set is not found
+ */
+static int
+dfa_state(struct rx_states *st, int *list, int n) {
+  int i, t;
+
+  qsort(list, (size_t) n, sizeof(int), compare_int);
+  for (i = hash_list(list, n) & (st->table_size - 1); (t = st->table[i]) >= 0; i = (i + 1) & (st->table_size - 1)) {
+    if (st->length[t] == n && !memcmp(st->pool + st->start[t], list, (size_t) n * sizeof(int))) return t;
+  }
+
+  t = st->count++;
+  if (t == st->size) {
+    st->size *= 2;
+    st->start = xrealloc(st->start, (size_t) st->size * sizeof(int));
+    st->length = xrealloc(st->length, (size_t) st->size * sizeof(int));
+  }
+  if (st->pool_length + n > st->pool_size) {
+    st->pool_size = 2 * st->pool_size + n;
+    st->pool = xrealloc(st->pool, (size_t) st->pool_size * sizeof(int));
+  }
+  memcpy(st->pool + st->pool_length, list, (size_t) n * sizeof(int));
+  st->start[t] = st->pool_length;
+  st->length[t] = n;
+  st->pool_length += n;
+  st->table[i] = t;
+
+  if (2 * st->count > st->table_size) {
+    free(st->table);
+    st->table_size *= 2;
+    st->table = xmalloc((size_t) st->table_size * sizeof(int));
+    for (i = 0; i < st->table_size; i++) st->table[i] = -1;
+    for (t = 0; t < st->count; t++) {
+      for (i = hash_list(st->pool + st->start[t], st->length[t]) & (st->table_size - 1);
+           st->table[i] >= 0; i = (i + 1) & (st->table_size - 1));
+      st->table[i] = t;
+    }
+    t = st->count - 1;
+  }
+  return t;
+}
+
+/**
+ * build the DFA from the program. A DFA state is the set of byte, match and $ instructions
+ * the program can be at, state 0 has none and never matches.
+ */
+static void
+build_dfa(struct regex *r, char *expression) {
+  struct rx_states st;
+  int *list, *stack, representative[256];
+  unsigned int *mark, generation = 0;
+  int s, c, i, n, pc;
+
+  for (i = 255; i >= 0; i--) representative[r->class[i]] = i;
+  mark = xmalloc((size_t) r->program_length * sizeof(unsigned int));
+  memset(mark, 0, (size_t) r->program_length * sizeof(unsigned int));
+  list = xmalloc((size_t) r->program_length * sizeof(int));
+  stack = xmalloc((size_t) (2 * r->program_length + 2) * sizeof(int));
+
+  st.pool_size = r->program_length + 1;
+  st.pool = xmalloc((size_t) st.pool_size * sizeof(int));
+  st.pool_length = 0;
+  st.size = 64;
+  st.start = xmalloc((size_t) st.size * sizeof(int));
+  st.length = xmalloc((size_t) st.size * sizeof(int));
+  st.count = 0;
+  st.table_size = 128;
+  st.table = xmalloc((size_t) st.table_size * sizeof(int));
+  for (i = 0; i < st.table_size; i++) st.table[i] = -1;
+
+  dfa_state(&st, list, 0);
+  r->start = dfa_state(&st, list, closure(r, 0, list, 0, mark, ++generation, stack, 0));
+  r->bol = dfa_state(&st, list, closure(r, 0, list, 0, mark, ++generation, stack, REGEX_BOL));
+
+  r->next = NULL;
+  r->accept = NULL;
+  for (s = 0; s < st.count; s++) {
+    if ((off_t) (s + 1) * r->classes > (off_t) (AUTOMATON_MAX / sizeof(int)))
+      panic("Regular expression too complex", expression, NULL);
+    if ((s & 63) == 0) {
+      r->next = xrealloc(r->next, (size_t) (s + 64) * r->classes * sizeof(int));
+      r->accept = xrealloc(r->accept, (size_t) (s + 64));
+    }
+    r->accept[s] = 0;
+    n = 0;
+    generation++;
+    for (i = 0; i < st.length[s]; i++) {
+      pc = st.pool[st.start[s] + i];
+      if (r->program[pc].code == RX_MATCH) r->accept[s] |= 1;
+      if (r->program[pc].code == RX_EOL) n = closure(r, pc + 1, list, n, mark, generation, stack, REGEX_EOL);
+    }
+    for (i = 0; i < n; i++) {
+      if (r->program[list[i]].code == RX_MATCH) r->accept[s] |= 2;
+    }
+
+    for (c = 0; c < r->classes; c++) {
+      n = 0;
+      generation++;
+      for (i = 0; i < st.length[s]; i++) {
+        pc = st.pool[st.start[s] + i];
+        if (r->program[pc].code == RX_BYTE && in_set(r, r->program[pc].x, representative[c]))
+          n = closure(r, pc + 1, list, n, mark, generation, stack, 0);
+      }
+      r->next[s * r->classes + c] = dfa_state(&st, list, n);
+    }
+  }
+  r->states = st.count;
+
+  for (i = 0; i < 256; i++) {                     // accepting states are known after all are built
+    r->ending[i] = 0;
+    for (s = 0; s < r->states && !r->ending[i]; s++) r->ending[i] = r->accept[r->next[s * r->classes + r->class[i]]];
+  }
+
+  free(mark);
+  free(list);
+  free(stack);
+  free(st.pool);
+  free(st.start);
+  free(st.length);
+  free(st.table);
+}
+
+/**
+ * parse expression to nodes, byte sets of the expression are added to r
+ */
+static struct rx_node *
+parse_regex(struct regex *r, char *expression) {
+  struct rx_parser ps;
+  struct rx_node *n;
+
+  ps.expression = expression;
+  ps.p = expression;
+  ps.r = r;
+  n = parse_alternation(&ps, 0);
+  if (*ps.p != 0) panic("Unmatched ) in regular expression", expression, NULL);
+  return n;
+}
+
+/**
+ * compile the nodes to the program and the program to the DFA of r
+ */
+static void
+compile_program(struct regex *r, char *expression, struct rx_node *n) {
+  compile_node(r, expression, n);
+  emit(r, expression, RX_MATCH, 0, 0);
+  init_classes(r);
+  build_dfa(r, expression);
+}
+
+/**
+ * @return true if the nodes can match without consuming a byte
+ */
+static int
+nullable(struct rx_node *n) {
+  switch (n->type) {
+    case RX_SET:
+      return 0;
+    case RX_CAT:
+      return nullable(n->left) && nullable(n->right);
+    case RX_ALT:
+      return nullable(n->left) || nullable(n->right);
+    case RX_REPEAT:
+      return n->min == 0 || nullable(n->left);
+    case RX_GROUP:
+      return nullable(n->left);
+    default:
+      return 1;
+  }
+}
+
+/**
+ * reverse the nodes to match the bytes from last to first, ^ and $ change places
+ */
+static void
+reverse_node(struct rx_node *n) {
+  struct rx_node *t;
+
+  if (n == NULL) return;
+  if (n->type == RX_CAT) {
+    t = n->left;
+    n->left = n->right;
+    n->right = t;
+  }
+  if (n->type == RX_ANCHOR) n->set = n->set == RX_BOL ? RX_EOL : RX_BOL;
+  reverse_node(n->left);
+  reverse_node(n->right);
+}
+
+/**
+ * compile a regular expression of a t command. Expressions have the syntax of POSIX extended
+ * regular expressions, without back references, and they match bytes: . matches any byte,
+ * escape codes of strings can be used, and other characters after a backslash match as such.
+ * ^ and $ match at the start and end of the block.
+ * @return the expression compiled to a DFA
+ */
+struct regex *
+compile_regex(char *expression) {
+  struct rx_node *n;
+  struct regex *r;
+
+  r = xmalloc(sizeof(struct regex));
+  memset(r, 0, sizeof(struct regex));
+  n = parse_regex(r, expression);
+  compile_program(r, expression, n);
+  free_node(n);
+  return r;
+}
+
+/**
+ * compile a regular expression block delimiter. The DFA finds the ends of the matches in
+ * one pass over the input: it is compiled from .* followed by the expression, so it reaches
+ * an accepting state at every byte a match ends with. The DFA of reverse is compiled from
+ * the expression reversed, it is run back from the end of a match to find where the match
+ * starts. ^ and $ match at the start and end of the input.
+ * @return the expression compiled to DFAs
+ */
+struct regex *
+compile_delimiter(char *expression) {
+  struct rx_node *n, *any;
+  struct regex *r;
+
+  r = xmalloc(sizeof(struct regex));
+  memset(r, 0, sizeof(struct regex));
+  n = parse_regex(r, expression);
+  if (nullable(n)) panic("Regular expression matches empty input", expression, NULL);
+  any = new_node(RX_REPEAT, any_node(r), NULL);
+  any->min = 0;
+  any->max = -1;
+  n = new_node(RX_CAT, any, n);
+
+  r->reverse = xmalloc(sizeof(struct regex));
+  memset(r->reverse, 0, sizeof(struct regex));
+  r->reverse->set = r->set;                      // sets are shared, all are added
+  r->reverse->sets = r->sets;
+
+  compile_program(r, expression, n);
+  reverse_node(n->right);
+  compile_program(r->reverse, expression, n->right);
+  free_node(n);
+  return r;
+}
+
+/**
+ * parse the replacement of a t command. \1 to \9 are replaced by the bytes matched by the
+ * groups of the expression and & by the whole match, \& is &. Other escape codes are those
+ * of strings, except decimal codes.
+ */
+void
+parse_replacement(struct regex *r, char *replace) {
+  char *p = replace;
+  int k, n = 0;
+
+  r->replace = xmalloc(strlen(replace) + 1);
+  r->reference = xmalloc((strlen(replace) + 1) * sizeof(int));
+  r->expansion_max = 0;
+  while (*p != 0) {
+    k = -1;
+    if (*p == '&') {
+      r->reference[n] = 0;
+      p++;
+    } else if (p[0] == '\\' && p[1] >= '1' && p[1] <= '9') {
+      r->reference[n] = p[1] - '0';
+      if (r->reference[n] > r->groups) panic("Invalid group reference in replacement", replace, NULL);
+      p += 2;
+    } else if (p[0] == '\\' && p[1] == '&') {
+      k = '&';
+      p += 2;
+    } else if (*p == '\\') {
+      p++;
+      k = parse_escape(&p, replace);
+      if (k < 0) panic("Syntax error in escape code", replace, NULL);
+    } else {
+      k = (unsigned char) *p++;
+    }
+    if (k >= 0) {
+      r->replace[n] = (unsigned char) k;
+      r->reference[n] = -1;
+      r->expansion_max++;
+    } else {
+      r->references = 1;
+      r->expansion_max += REGEX_MATCH_MAX;
+    }
+    n++;
+  }
+  r->replace_length = n;
+}
+
+/**
+ * make room in the thread storage for the program of r
+ */
+static void
+alloc_threads(struct regex *r) {
+  int size, slots, i;
+
+  size = r->program_length;
+  slots = 2 * (r->groups + 1);
+  if (size <= threads.size && slots <= threads.slots) return;
+  if (size < threads.size) size = threads.size;
+  if (slots < threads.slots) slots = threads.slots;
+
+  for (i = 0; i < 2; i++) {
+    threads.pc[i] = xrealloc(threads.pc[i], (size_t) size * sizeof(int));
+    threads.caps[i] = xrealloc(threads.caps[i], (size_t) size * slots * sizeof(off_t));
+  }
+  threads.mark = xrealloc(threads.mark, (size_t) size * sizeof(unsigned int));
+  memset(threads.mark, 0, (size_t) size * sizeof(unsigned int));
+  threads.generation = 0;
+  threads.stack = xrealloc(threads.stack, (size_t) (2 * size + 2) * sizeof(int));
+  threads.old = xrealloc(threads.old, (size_t) (size + 1) * sizeof(off_t));
+  threads.work = xrealloc(threads.work, (size_t) slots * sizeof(off_t));
+  threads.group = xrealloc(threads.group, (size_t) slots * sizeof(off_t));
+  threads.size = size;
+  threads.slots = slots;
+}
+
+/**
+ * add a thread at instruction pc with group slots caps at position pos to list l, and the
+ * threads it continues to without consuming a byte, in priority order. Anchors in anchors hold.
+ */
+static void
+add_thread(struct regex *r, int l, int pc, off_t *caps, off_t pos, int anchors) {
+  int sp = 0, saved = 0, slots = 2 * (r->groups + 1);
+
+  threads.stack[sp++] = pc;
+  while (sp) {
+    pc = threads.stack[--sp];
+    if (pc < -1) {                        // restore a slot changed by RX_SAVE
+      caps[-2 - pc] = threads.old[--saved];
+      continue;
+    }
+    if (threads.mark[pc] == threads.generation) continue;
+    threads.mark[pc] = threads.generation;
+    switch (r->program[pc].code) {
+      case RX_JMP:
+        threads.stack[sp++] = r->program[pc].x;
+        break;
+      case RX_SPLIT:
+        threads.stack[sp++] = r->program[pc].y;
+        threads.stack[sp++] = r->program[pc].x;
+        break;
+      case RX_SAVE:
+        threads.old[saved++] = caps[r->program[pc].x];
+        threads.stack[sp++] = -2 - r->program[pc].x;
+        caps[r->program[pc].x] = pos;
+        threads.stack[sp++] = pc + 1;
+        break;
+      case RX_BOL:
+      case RX_EOL:
+        if (anchors & (r->program[pc].code == RX_BOL ? REGEX_BOL : REGEX_EOL)) threads.stack[sp++] = pc + 1;
+        break;
+      default:
+        threads.pc[l][threads.count[l]] = pc;
+        memcpy(threads.caps[l] + threads.count[l] * slots, caps, (size_t) slots * sizeof(off_t));
+        threads.count[l]++;
+        break;
+    }
+  }
+}
+
+/**
+ * find the groups of a match of length bytes, first byte of the match is first and the others
+ * are at rest. The groups are those of the first way in priority order the expression
+ * matches all length bytes. group[2 * n] and group[2 * n + 1] are set to the start and end
+ * of group n in the match, -1 if the group did not match. Anchors are REGEX_BOL and REGEX_EOL
+ * holding at the start and end of the match.
+ */
+static void
+find_groups(struct regex *r, unsigned char first, unsigned char *rest, off_t length, int anchors, off_t *group) {
+  int slots, i, l, pc;
+  off_t k, *caps;
+  unsigned char byte;
+
+  alloc_threads(r);
+  slots = 2 * (r->groups + 1);
+  for (i = 0; i < slots; i++) threads.work[i] = -1;
+  for (i = 0; i < slots; i++) group[i] = -1;
+
+  l = 0;
+  threads.count[l] = 0;
+  threads.generation++;
+  add_thread(r, l, 0, threads.work, (off_t) 0, anchors & (length ? REGEX_BOL : REGEX_BOL | REGEX_EOL));
+  for (k = 0; threads.count[l]; k++) {
+    byte = k ? rest[k - 1] : first;
+    threads.count[!l] = 0;
+    threads.generation++;
+    for (i = 0; i < threads.count[l]; i++) {
+      pc = threads.pc[l][i];
+      caps = threads.caps[l] + i * slots;
+      if (r->program[pc].code == RX_MATCH) {
+        if (k == length) {
+          memcpy(group, caps, (size_t) slots * sizeof(off_t));
+          group[0] = 0;
+          group[1] = length;
+          return;
+        }
+      } else if (k < length && in_set(r, r->program[pc].x, byte)) {
+        add_thread(r, !l, pc + 1, caps, k + 1, k + 1 == length ? anchors & REGEX_EOL : 0);
+      }
+    }
+    l = !l;
+  }
+}
+
+/**
+ * put the replacement of a t command for a match of length bytes to target, first byte of the
+ * match is first and the others are at rest, anchors are those holding for the match. Target
+ * must have room for expansion_max bytes.
+ * @return length of the replacement
+ */
+off_t
+expand_replacement(struct regex *r, unsigned char first, unsigned char *rest, off_t length, int anchors,
+                   unsigned char *target) {
+  off_t *group = threads.group, n = 0, k;
+  int i, g;
+
+  if (r->references) {
+    alloc_threads(r);
+    group = threads.group;
+    find_groups(r, first, rest, length, anchors, group);
+  }
+  for (i = 0; i < r->replace_length; i++) {
+    g = r->reference[i];
+    if (g < 0) {
+      target[n++] = r->replace[i];
+    } else if (group[2 * g] >= 0 && group[2 * g + 1] >= group[2 * g]) {
+      for (k = group[2 * g]; k < group[2 * g + 1]; k++) target[n++] = k ? rest[k - 1] : first;
+    }
+  }
+  return n;
+}
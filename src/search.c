@@ -0,0 +1,517 @@
+/*
+ *    bbe - Binary block editor
+ *
+ *    Copyright (C) 2005 Timo Savinen
+ *    This file is part of bbe.
+ *
+ *    bbe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    bbe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with bbe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "bbe.h"
+#include <string.h>
+
+/**
+ * patterns up to this length are searched by filtering candidates with their first and last byte
+ */
+#define SEARCH_SHORT 32
+
+/**
+ * compute the maximal suffix of pattern, using either normal or reversed byte order
+ * @return start of the suffix minus one, period of the suffix in *period
+ */
+static size_t
+maximal_suffix(unsigned char *string, size_t length, int reversed, size_t *period) {
+  size_t ms, j, k, p;
+  unsigned char a, b;
+
+  ms = (size_t) -1;
+  j = 0;
+  k = p = 1;
+
+  while (j + k < length) {
+    a = string[ms + k];
+    b = string[j + k];
+    if (a == b) {
+      if (k == p) {
+        j += p;
+        k = 1;
+      } else {
+        k++;
+      }
+    } else if (reversed ? a < b : a > b) {
+      j += k;
+      k = 1;
+      p = j - ms;
+    } else {
+      ms = j++;
+      k = p = 1;
+    }
+  }
+  *period = p;
+  return ms;
+}
+
+/**
+ * search a one byte pattern
+ */
+static unsigned char *
+find_byte(struct search *s, unsigned char *scan, unsigned char *last) {
+  return memchr(scan, s->pattern->string[0], (size_t) (last - scan) + 1);
+}
+
+/**
+ * two-way search, used for long patterns and for the tail of the short pattern search
+ */
+static unsigned char *
+find_two_way(struct search *s, unsigned char *scan, unsigned char *last) {
+  unsigned char *string = s->pattern->string;
+  size_t length = (size_t) s->pattern->length;
+  size_t k, mem = 0;
+
+  while (scan <= last) {
+    k = s->skip[scan[length - 1]];       // last byte of window first
+    if (k) {
+      if (k < mem) k = mem;
+      scan += k;
+      mem = 0;
+      continue;
+    }
+
+    k = s->split > mem ? s->split : mem;  // right half
+    while (k < length && string[k] == scan[k]) k++;
+    if (k < length) {
+      scan += k - s->split + 1;
+      mem = 0;
+      continue;
+    }
+
+    k = s->split;                         // left half
+    while (k > mem && string[k - 1] == scan[k - 1]) k--;
+    if (k <= mem) return scan;
+    scan += s->period;
+    mem = s->memory;
+  }
+  return NULL;
+}
+
+/**
+ * compare a masked pattern to the bytes at p
+ * @return true if all bits under the mask are equal
+ */
+static inline int
+masked_equal(struct pattern *pattern, unsigned char *p, size_t from) {
+  size_t i;
+
+  for (i = from; i < (size_t) pattern->length; i++) {
+    if ((p[i] & pattern->mask[i]) != pattern->string[i]) return 0;
+  }
+  return 1;
+}
+
+/**
+ * search a masked pattern, the bytes at the filter positions are compared first
+ */
+static unsigned char *
+find_masked(struct search *s, unsigned char *scan, unsigned char *last) {
+  struct pattern *pattern = s->pattern;
+  size_t f0 = s->filter[0], f1 = s->filter[1];
+
+  for (; scan <= last; scan++) {
+    if ((scan[f0] & pattern->mask[f0]) == pattern->string[f0] &&
+        (scan[f1] & pattern->mask[f1]) == pattern->string[f1] &&
+        masked_equal(pattern, scan, 0)) return scan;
+  }
+  return NULL;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/**
+ * compare the first and the last byte of the pattern at 16 positions at a time,
+ * only the candidates are compared fully
+ */
+__attribute__((target("sse2")))
+static unsigned char *
+find_short_sse2(struct search *s, unsigned char *scan, unsigned char *last) {
+  unsigned char *string = s->pattern->string;
+  size_t length = (size_t) s->pattern->length;
+  __m128i first = _mm_set1_epi8((char) string[0]);
+  __m128i final = _mm_set1_epi8((char) string[length - 1]);
+  unsigned int mask;
+  int bit;
+
+  while (last - scan >= 15) {
+    mask = (unsigned int) _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(first, _mm_loadu_si128((__m128i *) scan)),
+                      _mm_cmpeq_epi8(final, _mm_loadu_si128((__m128i *) (scan + length - 1)))));
+    while (mask) {
+      bit = __builtin_ctz(mask);
+      if (memcmp(scan + bit + 1, string + 1, length - 2) == 0) return scan + bit;
+      mask &= mask - 1;
+    }
+    scan += 16;
+  }
+  return find_two_way(s, scan, last);
+}
+
+/**
+ * same as find_short_sse2, 32 positions at a time
+ */
+__attribute__((target("avx2")))
+static unsigned char *
+find_short_avx2(struct search *s, unsigned char *scan, unsigned char *last) {
+  unsigned char *string = s->pattern->string;
+  size_t length = (size_t) s->pattern->length;
+  __m256i first = _mm256_set1_epi8((char) string[0]);
+  __m256i final = _mm256_set1_epi8((char) string[length - 1]);
+  unsigned int mask;
+  int bit;
+
+  while (last - scan >= 31) {
+    mask = (unsigned int) _mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(first, _mm256_loadu_si256((__m256i *) scan)),
+                         _mm256_cmpeq_epi8(final, _mm256_loadu_si256((__m256i *) (scan + length - 1)))));
+    while (mask) {
+      bit = __builtin_ctz(mask);
+      if (memcmp(scan + bit + 1, string + 1, length - 2) == 0) return scan + bit;
+      mask &= mask - 1;
+    }
+    scan += 32;
+  }
+  return find_two_way(s, scan, last);
+}
+
+/**
+ * masked_equal 16 bytes at a time
+ */
+__attribute__((target("sse2")))
+static inline int
+masked_equal_sse2(struct pattern *pattern, unsigned char *p) {
+  size_t i, length = (size_t) pattern->length;
+  __m128i bytes;
+
+  for (i = 0; i + 16 <= length; i += 16) {
+    bytes = _mm_and_si128(_mm_loadu_si128((__m128i *) (p + i)), _mm_loadu_si128((__m128i *) (pattern->mask + i)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_loadu_si128((__m128i *) (pattern->string + i)))) != 0xffff)
+      return 0;
+  }
+  return masked_equal(pattern, p, i);
+}
+
+/**
+ * compare the filter positions of a masked pattern at 16 positions at a time,
+ * only the candidates are compared fully
+ */
+__attribute__((target("sse2")))
+static unsigned char *
+find_masked_sse2(struct search *s, unsigned char *scan, unsigned char *last) {
+  struct pattern *pattern = s->pattern;
+  size_t f0 = s->filter[0], f1 = s->filter[1];
+  __m128i string0 = _mm_set1_epi8((char) pattern->string[f0]);
+  __m128i mask0 = _mm_set1_epi8((char) pattern->mask[f0]);
+  __m128i string1 = _mm_set1_epi8((char) pattern->string[f1]);
+  __m128i mask1 = _mm_set1_epi8((char) pattern->mask[f1]);
+  unsigned int mask;
+  int bit;
+
+  while (last - scan >= 15) {
+    mask = (unsigned int) _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(string0, _mm_and_si128(mask0, _mm_loadu_si128((__m128i *) (scan + f0)))),
+                      _mm_cmpeq_epi8(string1, _mm_and_si128(mask1, _mm_loadu_si128((__m128i *) (scan + f1))))));
+    while (mask) {
+      bit = __builtin_ctz(mask);
+      if (masked_equal_sse2(pattern, scan + bit)) return scan + bit;
+      mask &= mask - 1;
+    }
+    scan += 16;
+  }
+  return find_masked(s, scan, last);
+}
+
+/**
+ * masked_equal 32 bytes at a time
+ */
+__attribute__((target("avx2")))
+static inline int
+masked_equal_avx2(struct pattern *pattern, unsigned char *p) {
+  size_t i, length = (size_t) pattern->length;
+  __m256i bytes;
+
+  for (i = 0; i + 32 <= length; i += 32) {
+    bytes = _mm256_and_si256(_mm256_loadu_si256((__m256i *) (p + i)),
+                             _mm256_loadu_si256((__m256i *) (pattern->mask + i)));
+    if ((unsigned int) _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(bytes, _mm256_loadu_si256((__m256i *) (pattern->string + i)))) != 0xffffffff)
+      return 0;
+  }
+  return masked_equal(pattern, p, i);
+}
+
+/**
+ * same as find_masked_sse2, 32 positions at a time
+ */
+__attribute__((target("avx2")))
+static unsigned char *
+find_masked_avx2(struct search *s, unsigned char *scan, unsigned char *last) {
+  struct pattern *pattern = s->pattern;
+  size_t f0 = s->filter[0], f1 = s->filter[1];
+  __m256i string0 = _mm256_set1_epi8((char) pattern->string[f0]);
+  __m256i mask0 = _mm256_set1_epi8((char) pattern->mask[f0]);
+  __m256i string1 = _mm256_set1_epi8((char) pattern->string[f1]);
+  __m256i mask1 = _mm256_set1_epi8((char) pattern->mask[f1]);
+  unsigned int mask;
+  int bit;
+
+  while (last - scan >= 31) {
+    mask = (unsigned int) _mm256_movemask_epi8(
+        _mm256_and_si256(
+            _mm256_cmpeq_epi8(string0, _mm256_and_si256(mask0, _mm256_loadu_si256((__m256i *) (scan + f0)))),
+            _mm256_cmpeq_epi8(string1, _mm256_and_si256(mask1, _mm256_loadu_si256((__m256i *) (scan + f1))))));
+    while (mask) {
+      bit = __builtin_ctz(mask);
+      if (masked_equal_avx2(pattern, scan + bit)) return scan + bit;
+      mask &= mask - 1;
+    }
+    scan += 32;
+  }
+  return find_masked(s, scan, last);
+}
+
+#endif
+
+/**
+ * choose the filter positions of a masked pattern, the first position with most bits under
+ * the mask and, of the other positions with most bits, the one farthest from it
+ */
+static void
+init_masked_search(struct search *s, struct pattern *pattern) {
+  size_t i, length = (size_t) pattern->length;
+  size_t distance, far = 0;
+  int bits[256], best0 = -1, best1 = -1;
+
+  for (i = 0; i < 256; i++) bits[i] = i ? bits[i & (i - 1)] + 1 : 0;
+
+  s->filter[0] = s->filter[1] = 0;
+  for (i = 0; i < length; i++) {
+    if (bits[pattern->mask[i]] > best0) {
+      best0 = bits[pattern->mask[i]];
+      s->filter[0] = i;
+    }
+  }
+  for (i = 0; i < length; i++) {
+    if (i == s->filter[0]) continue;
+    distance = i > s->filter[0] ? i - s->filter[0] : s->filter[0] - i;
+    if (bits[pattern->mask[i]] > best1 || (bits[pattern->mask[i]] == best1 && distance > far)) {
+      best1 = bits[pattern->mask[i]];
+      far = distance;
+      s->filter[1] = i;
+    }
+  }
+
+  s->find = find_masked;
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  s->find = __builtin_cpu_supports("avx2") ? find_masked_avx2 : find_masked_sse2;
+#endif
+}
+
+/**
+ * prepare the search tables for pattern, two-way critical factorization and a shift table
+ * for the last byte of the window. Masked patterns are filtered by two of their bytes.
+ */
+void
+init_search(struct search *s, struct pattern *pattern) {
+  size_t i, length, ms, ms_r, period, period_r;
+
+  s->pattern = pattern;
+  length = (size_t) pattern->length;
+  if (pattern->mask != NULL && length) {
+    init_masked_search(s, pattern);
+    return;
+  }
+
+  s->find = length == 1 ? find_byte : find_two_way;
+#ifdef HAVE_X86_SIMD
+  if (length > 1 && length <= SEARCH_SHORT) {
+    __builtin_cpu_init();
+    s->find = __builtin_cpu_supports("avx2") ? find_short_avx2 : find_short_sse2;
+  }
+#endif
+
+  for (i = 0; i < 256; i++) s->skip[i] = length;
+  for (i = 0; i + 1 < length; i++) s->skip[pattern->string[i]] = length - 1 - i;
+  if (!length) return;
+  s->skip[pattern->string[length - 1]] = 0;
+
+  ms = maximal_suffix(pattern->string, length, 0, &period);
+  ms_r = maximal_suffix(pattern->string, length, 1, &period_r);
+  if (ms_r + 1 > ms + 1) {
+    ms = ms_r;
+    period = period_r;
+  }
+  s->split = ms + 1;
+
+  if (memcmp(pattern->string, pattern->string + period, s->split) == 0) {
+    s->period = period;                    // periodic pattern, remember the matched part after a shift
+    s->memory = length - period;
+  } else {
+    s->period = (s->split > length - s->split ? s->split : length - s->split) + 1;
+    s->memory = 0;
+  }
+}
+
+/**
+ * search the first occurrence of the pattern starting between scan and last (inclusive),
+ * bytes up to last + pattern length - 1 must be readable.
+ * @return pointer to the start of the occurrence or NULL if not found
+ */
+unsigned char *
+find_pattern(struct search *s, unsigned char *scan, unsigned char *last) {
+  if (scan > last) return NULL;
+  return s->find(s, scan, last);
+}
+
+/**
+ * build the automaton for one string too long for a transition table, state is the number of
+ * bytes matched and the failure function gives the next shorter prefix which is also a suffix
+ * of the matched bytes, see scan_substs() in execute.c
+ */
+static void
+init_failure_function(struct automaton *a, struct pattern *string) {
+  off_t q, k, length = string->length;
+
+  a->next = NULL;
+  a->string = string->string;
+  a->longest = length;
+  a->fail = xmalloc((size_t) (length + 1) * sizeof(int));
+  a->fail[0] = a->fail[1] = 0;
+  k = 0;
+  for (q = 1; q < length; q++) {
+    while (k && string->string[q] != string->string[k]) k = a->fail[k];
+    if (string->string[q] == string->string[k]) k++;
+    a->fail[q + 1] = (int) k;
+  }
+
+  a->output_start = xmalloc((size_t) (length + 1) * sizeof(int));
+  a->output_end = xmalloc((size_t) (length + 1) * sizeof(int));
+  for (q = 0; q <= length; q++) a->output_start[q] = a->output_end[q] = 0;
+  a->output_end[length] = 1;
+  a->matches = xmalloc(sizeof(int));
+  a->matches[0] = 0;
+}
+
+/**
+ * build the Aho-Corasick automaton for count strings as a table of transitions for every
+ * state and byte class. The automaton reports the index of each string found, empty strings
+ * are not found. A single string too long for the table gets a failure function instead.
+ * @return false if the table would be bigger than AUTOMATON_MAX bytes
+ */
+int
+init_automaton(struct automaton *a, struct pattern *strings, int count) {
+  int *fail, *queue, *next, *ends, *same;
+  int i, c, s, t, f, states, head, tail, n, size, class[256];
+  off_t j, total;
+
+  for (c = 0; c < 256; c++) class[c] = -1;
+  n = 0;
+  a->longest = 0;
+  total = 1;
+  for (i = 0; i < count; i++) {
+    for (j = 0; j < strings[i].length; j++) {
+      if (class[strings[i].string[j]] < 0) class[strings[i].string[j]] = n++;
+    }
+    if (strings[i].length > a->longest) a->longest = strings[i].length;
+    total += strings[i].length;
+  }
+  a->classes = n < 256 ? n + 1 : n;               // class 0 is for the bytes not in any string
+  for (c = 0; c < 256; c++) a->class[c] = (unsigned char) (n < 256 ? class[c] + 1 : class[c]);
+  for (a->shift = 0; 1 << a->shift < a->classes; a->shift++);
+  a->classes = 1 << a->shift;
+  if (total * a->classes > (off_t) (AUTOMATON_MAX / sizeof(int))) {
+    if (count != 1) return 0;
+    init_failure_function(a, strings);
+    return 1;
+  }
+
+  next = xmalloc((size_t) total * a->classes * sizeof(int));
+  memset(next, 0, (size_t) total * a->classes * sizeof(int));
+  ends = xmalloc((size_t) total * sizeof(int));
+  for (s = 0; s < total; s++) ends[s] = -1;
+  same = xmalloc((size_t) (count + 1) * sizeof(int));
+
+  states = 1;                            // trie, no edge leads to the root state 0
+  for (i = count - 1; i >= 0; i--) {     // strings ending in a state are listed in order
+    if (!strings[i].length) continue;
+    s = 0;
+    for (j = 0; j < strings[i].length; j++) {
+      t = s * a->classes + a->class[strings[i].string[j]];
+      if (!next[t]) next[t] = states++;
+      s = next[t];
+    }
+    same[i] = ends[s];
+    ends[s] = i;
+  }
+
+  fail = xmalloc((size_t) states * sizeof(int));
+  queue = xmalloc((size_t) states * sizeof(int));
+  a->output_start = xmalloc((size_t) states * sizeof(int));
+  a->output_end = xmalloc((size_t) states * sizeof(int));
+  size = count + 1;
+  a->matches = xmalloc((size_t) size * sizeof(int));
+  n = 0;
+
+  fail[0] = 0;
+  head = tail = 0;
+  queue[tail++] = 0;
+  while (head < tail) {                  // breadth first, the failure state is complete before
+    s = queue[head++];
+    f = fail[s];
+    for (i = ends[s], t = 0; i >= 0; i = same[i]) t++;
+    if (s) t += a->output_end[f] - a->output_start[f];
+    if (n + t > size) {
+      size = 2 * size + t;
+      a->matches = xrealloc(a->matches, (size_t) size * sizeof(int));
+    }
+    a->output_start[s] = n;              // strings ending here and those ending in the failure state
+    for (i = ends[s]; i >= 0; i = same[i]) a->matches[n++] = i;
+    if (s) {
+      for (i = a->output_start[f]; i < a->output_end[f]; i++) a->matches[n++] = a->matches[i];
+    }
+    a->output_end[s] = n;
+
+    for (c = 0; c < a->classes; c++) {
+      t = next[s * a->classes + c];
+      if (t) {
+        fail[t] = s ? next[f * a->classes + c] : 0;
+        queue[tail++] = t;
+      } else if (s) {
+        next[s * a->classes + c] = next[f * a->classes + c];
+      }
+    }
+  }
+
+  for (i = 0; i < states * a->classes; i++) {   // row offsets, negative if strings end there
+    t = next[i];
+    next[i] = a->output_end[t] > a->output_start[t] ? ~(t * a->classes) : t * a->classes;
+  }
+  a->next = next;
+
+  free(ends);
+  free(same);
+  free(fail);
+  free(queue);
+  return 1;
+}
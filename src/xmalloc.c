@@ -1,50 +1,103 @@
-/*
- *    bbe - Binary block editor
- *
- *    Copyright (C) 2005 Timo Savinen
- *    This file is part of bbe.
- * 
- *    bbe is free software; you can redistribute it and/or modify
- *    it under the terms of the GNU General Public License as published by
- *    the Free Software Foundation; either version 2 of the License, or
- *    (at your option) any later version.
- *
- *    bbe is distributed in the hope that it will be useful,
- *    but WITHOUT ANY WARRANTY; without even the implied warranty of
- *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *    GNU General Public License for more details.
- *
- *    You should have received a copy of the GNU General Public License
- *    along with bbe; if not, write to the Free Software
- *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
- *
- */
-
-/* $Id: xmalloc.c,v 1.3 2005/10/19 18:39:13 timo Exp $ */
-
-#include "bbe.h"
-#include <stdlib.h>
-#include <string.h>
-
-/**
- * extends malloc with out of memory detection
- * @return pointer to newly allocated memory
- */
-void *
-xmalloc(size_t size) {
-  register void *value = malloc(size);
-  if (value == 0) panic("Out of memory", NULL, NULL);
-  return value;
-}
-
-/**
- * extends strdup with out of memory detection
- * @return pointer to newly allocated memory
- */
-char *
-xstrdup(char *str) {
-  char *ret = strdup(str);
-  if (ret == NULL) panic("Out of memory", NULL, NULL);
-  return ret;
-}
-
+/*
+ *    bbe - Binary block editor
+ *
+ *    Copyright (C) 2005 Timo Savinen
+ *    This file is part of bbe.
+ * 
+ *    bbe is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    bbe is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with bbe; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* $Id: xmalloc.c,v 1.3 2005/10/19 18:39:13 timo Exp $ */
+
+#include "bbe.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * extends malloc with out of memory detection
+ * @return pointer to newly allocated memory
+ */
+void *
+xmalloc(size_t size) {
+  register void *value = malloc(size);
+  if (value == 0) panic("Out of memory", NULL, NULL);
+  return value;
+}
+
+/**
+ * extends realloc with out of memory detection
+ * @return pointer to reallocated memory
+ */
+void *
+xrealloc(void *ptr, size_t size) {
+  register void *value = realloc(ptr, size);
+  if (value == 0) panic("Out of memory", NULL, NULL);
+  return value;
+}
+
+/**
+ * allocate an I/O buffer. Buffers of at least HUGE_BUFFER bytes are mapped and backed by
+ * huge pages, reserved huge pages are used if the size is a multiple of HUGE_BUFFER.
+ * @return pointer to newly allocated buffer, released with free_buffer
+ */
+void *
+xmalloc_buffer(size_t size) {
+#ifdef HAVE_SYS_MMAN_H
+  void *value = MAP_FAILED;
+
+  if (size < HUGE_BUFFER) return xmalloc(size);
+#ifdef MAP_HUGETLB
+  if (size % HUGE_BUFFER == 0)
+    value = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+  if (value == MAP_FAILED) {
+    value = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (value == MAP_FAILED) panic("Out of memory", NULL, NULL);
+#ifdef MADV_HUGEPAGE
+    madvise(value, size, MADV_HUGEPAGE);
+#endif
+  }
+  return value;
+#else
+  return xmalloc(size);
+#endif
+}
+
+/**
+ * release a buffer allocated with xmalloc_buffer
+ */
+void
+free_buffer(void *buffer, size_t size) {
+#ifdef HAVE_SYS_MMAN_H
+  if (size >= HUGE_BUFFER) {
+    munmap(buffer, size);
+    return;
+  }
+#endif
+  free(buffer);
+}
+
+/**
+ * extends strdup with out of memory detection
+ * @return pointer to newly allocated memory
+ */
+char *
+xstrdup(char *str) {
+  char *ret = strdup(str);
+  if (ret == NULL) panic("Out of memory", NULL, NULL);
+  return ret;
+}
+
@@ -0,0 +1,26 @@
+#!/bin/sh
+#
+# bbe -i with block commands: J and L keep every block in place, K deletes blocks and is rejected.
+# usage: inplace_blocks.sh path-to-bbe
+#
+bbe="$1"
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+printf 'aaaaaaaaaaaa' > original
+
+cp original input
+"$bbe" -i -b :3 -e 'J 2' -e 'y/a/b/' input || exit 1
+printf 'aaaaaabbbbbb' > expected
+cmp expected input || { echo "J 2"; exit 1; }
+
+cp original input
+"$bbe" -i -b :3 -e 'L 2' -e 'y/a/b/' input || exit 1
+printf 'bbbbbbaaaaaa' > expected
+cmp expected input || { echo "L 2"; exit 1; }
+
+cp original input
+"$bbe" -i -b :3 -e 'K 2' -e 'y/a/b/' input 2> /dev/null && { echo "K 2 was accepted"; exit 1; }
+cmp original input || { echo "K 2 changed the input file"; exit 1; }
+exit 0
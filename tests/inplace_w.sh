@@ -0,0 +1,23 @@
+#!/bin/sh
+#
+# bbe -i with w commands: w needs every block although the input file is not changed.
+# usage: inplace_w.sh path-to-bbe
+#
+bbe="$1"
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+printf 'xx<1>yy<2>zz<3>..<4>--<5>!!' > input
+cp input original
+
+"$bbe" -i -b '/</:/>/' -e 'w all' input || exit 1
+"$bbe" -i -b '/</:/>/' -e 'J 3' -e 'w last' input || exit 1
+
+printf '<1><2><3><4><5>' > expected_all
+printf '<4><5>' > expected_last
+
+cmp original input || { echo "input file was changed"; exit 1; }
+cmp expected_all all || { echo "w without J"; exit 1; }
+cmp expected_last last || { echo "w after J 3"; exit 1; }
+exit 0
@@ -0,0 +1,24 @@
+#!/bin/sh
+#
+# s commands whose search strings use every byte value: each byte needs a class of its own.
+# usage: subst_classes.sh path-to-bbe
+#
+bbe="$1"
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+every=
+i=0
+while [ $i -lt 256 ]; do
+  every="$every$(printf '\\x%02x' $i)"
+  i=$((i + 1))
+done
+
+printf 'Q\000 Q\377' > input
+printf 'Q\000 Y' > expected
+
+"$bbe" -e "s/Z$every/X/" -e 's/Q\xff/Y/' -o output input || exit 1
+
+cmp expected output || { echo "bytes sharing a class were replaced"; exit 1; }
+exit 0